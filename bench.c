@@ -0,0 +1,420 @@
+// micro benchmarks for the editor core, built and run by make bench
+// usage: kilo_bench <dir> <size in MB>...
+// test files are generated into dir once and reused between runs
+// every result is printed as a "name value" line so runs of different
+// versions can be diffed or collected with awk
+
+#define KILO_NO_MAIN
+#include "kilo.c"
+
+#define BENCH_NEEDLE "kilo_bench_needle"
+
+/*** generated input ***/
+
+uint64_t benchRand(uint64_t *state) {
+  // xorshift64, same file for the same size every time
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+// source-like lines: indentation, words, numbers and separators
+int benchLine(uint64_t *state, char *buf, int bufsize) {
+  static const char *words[] = {"int",    "return", "editor", "row",
+                                "size",   "render", "if",     "while",
+                                "struct", "char",   "buf",    "len"};
+  int len = 0;
+  int indent = benchRand(state) % 4;
+  while (indent--)
+    buf[len++] = '\t';
+  int tokens = benchRand(state) % 12;
+  while (tokens-- && len < bufsize - 32) {
+    uint64_t r = benchRand(state);
+    if (r % 3 == 0)
+      len += snprintf(&buf[len], bufsize - len, "%d",
+                      (int)(r >> 8) % 100000);
+    else
+      len += snprintf(&buf[len], bufsize - len, "%s",
+                      words[(r >> 8) % (sizeof(words) / sizeof(words[0]))]);
+    buf[len++] = " ,;()+-="[(r >> 32) % 8];
+  }
+  buf[len++] = '\n';
+  return len;
+}
+
+void benchGenerate(char *path, size_t size) {
+  struct stat st;
+  if (stat(path, &st) == 0 && (size_t)st.st_size >= size)
+    return;
+
+  FILE *fp = fopen(path, "w");
+  if (!fp)
+    die("fopen");
+  uint64_t state = 88172645463325252ULL;
+  size_t written = 0;
+  char line[256];
+  while (written < size) {
+    int len = benchLine(&state, line, sizeof(line));
+    fwrite(line, 1, len, fp);
+    written += len;
+  }
+  fclose(fp);
+}
+
+/*** benchmarks ***/
+
+void benchOpen(char *path, int mb) {
+  uint64_t t = editorNow();
+  editorOpen(path);
+  uint64_t ns = editorNow() - t;
+  // big files start a trigram index, benchTrigrams builds its own so the
+  // other benchmarks don't share the cpu with it
+  trigramFree();
+  printf("open_%dmb_ms %.3f\n", mb, ns / 1e6);
+  printf("open_%dmb_mb_per_s %.1f\n", mb, mb / (ns / 1e9));
+  printf("open_%dmb_rows %d\n", mb, E.numrows);
+  // line index, row table, ownership bits and erows made so far
+  size_t bytes = sizeof(uint64_t) * (E.tb.nlines + 1) +
+                 (sizeof(erow *) + 2 + sizeof(unsigned int)) * E.tb.orig.cap +
+                 sizeof(uint64_t) * (E.tb.nlines / 64 + 1) + E.tb.arena.live;
+  printf("open_%dmb_bytes_per_row %.1f\n", mb,
+         E.numrows ? (double)bytes / E.numrows : 0);
+}
+
+// filetype of the open file, sniffing its first page every time
+void benchFiletype(int mb) {
+  int iters = 100000;
+  int j;
+  uint64_t t = editorNow();
+  for (j = 0; j < iters; j++)
+    editorSelectSyntaxHighlight();
+  uint64_t ns = editorNow() - t;
+  printf("filetype_%dmb_ns %.1f\n", mb, (double)ns / iters);
+}
+
+void benchUpdateRow() {
+  char chars[256];
+  int j;
+  // tab every few chars, the worst case for render expansion
+  for (j = 0; j < (int)sizeof(chars); j++)
+    chars[j] = j % 4 == 0 ? '\t' : 'a' + j % 26;
+
+  // a row of the empty buffer, its lexer state lives in the row table
+  editorInsertRow(0, chars, sizeof(chars));
+  erow *row = tbRow(&E.tb, 0);
+
+  int iters = 200000;
+  uint64_t t = editorNow();
+  for (j = 0; j < iters; j++)
+    editorUpdateRow(row);
+  uint64_t ns = editorNow() - t;
+  printf("update_row_tabs_ns %.1f\n", (double)ns / iters);
+  printf("update_row_tabs_mb_per_s %.1f\n",
+         (double)iters * row->size / 1e6 / (ns / 1e9));
+  editorCloseFile();
+}
+
+// a query that never matches walks every row once
+void benchFind(int mb) {
+  int i;
+  for (i = 0; i < 2; i++) {
+    uint64_t t = editorNow();
+    editorFindCallback(BENCH_NEEDLE, 'x');
+    uint64_t ns = editorNow() - t;
+    editorFindCallback(BENCH_NEEDLE, '\r');
+    printf("find_%dmb_%s_ms %.3f\n", mb, i ? "warm" : "cold", ns / 1e6);
+  }
+}
+
+// typing a query one char at a time, as the search prompt does
+void benchFindTyped(int mb, char *name) {
+  char query[] = "render(size";
+  char prefix[sizeof(query)];
+  int j;
+  uint64_t ns = 0, slowest = 0;
+  for (j = 1; j < (int)sizeof(query); j++) {
+    memcpy(prefix, query, j);
+    prefix[j] = '\0';
+    uint64_t t = editorNow();
+    editorFindCallback(prefix, query[j - 1]);
+    t = editorNow() - t;
+    ns += t;
+    if (t > slowest)
+      slowest = t;
+  }
+  editorFindCallback(query, '\r');
+  printf("find_%dmb_%s_ms %.3f\n", mb, name, ns / 1e6);
+  // a key costs about the rows still matching, the first few chars of a
+  // query match most of them
+  printf("find_%dmb_%s_max_key_ms %.3f\n", mb, name, slowest / 1e6);
+}
+
+// raw engine speed over the whole file in one block, no per-row overhead
+void benchSearchEngine(int mb) {
+  struct searchQuery q;
+  searchCompile(&q, BENCH_NEEDLE);
+  uint64_t t = editorNow();
+  searchFind(&q, E.tb.map, E.tb.maplen);
+  uint64_t ns = editorNow() - t;
+  printf("search_engine_%dmb_mb_per_s %.1f\n", mb,
+         E.tb.maplen / 1e6 / (ns / 1e9));
+}
+
+// highlighter speed over the whole file as one row, with the vector
+// classifier and with the table alone
+void benchHighlight(int mb) {
+  struct editorSyntax *syn = &HLDB[0];
+  unsigned char *hl = malloc(E.tb.maplen ? E.tb.maplen : 1);
+  // fault the pages in first, rows reuse their hl between frames
+  memset(hl, 0, E.tb.maplen);
+  int vector = syn->vector;
+  int pass;
+  for (pass = 0; pass < 2; pass++) {
+    const char *name = pass ? "scalar" : "vector";
+    syn->vector = pass ? HL_VEC_NONE : vector;
+    uint64_t t = editorNow();
+    editorSyntaxLex(syn, E.tb.map, E.tb.maplen, HLS_NORMAL, hl);
+    uint64_t ns = editorNow() - t;
+    printf("highlight_%dmb_%s_mb_per_s %.1f\n", mb, name,
+           E.tb.maplen / 1e6 / (ns / 1e9));
+    t = editorNow();
+    editorSyntaxLex(syn, E.tb.map, E.tb.maplen, HLS_NORMAL, NULL);
+    ns = editorNow() - t;
+    printf("highlight_state_%dmb_%s_mb_per_s %.1f\n", mb, name,
+           E.tb.maplen / 1e6 / (ns / 1e9));
+  }
+  syn->vector = vector;
+  free(hl);
+}
+
+// regex mode through the lazy dfa, never matches so every byte is read
+void benchFindRegex(int mb) {
+  E.regex = 1;
+  uint64_t t = editorNow();
+  editorFindCallback("needle[0-9]+|(int|char) +x{3}", 'x');
+  uint64_t ns = editorNow() - t;
+  editorFindCallback("", '\r');
+  E.regex = 0;
+  printf("find_%dmb_regex_ms %.3f\n", mb, ns / 1e6);
+}
+
+// build the trigram index in the foreground and search through it
+void benchTrigrams(int mb) {
+  uint64_t t = editorNow();
+  trigramStart();
+  pthread_join(E.trigrams.thread, NULL);
+  E.trigrams.running = 0;
+  uint64_t ns = editorNow() - t;
+  printf("trigram_build_%dmb_ms %.3f\n", mb, ns / 1e6);
+  printf("trigram_%dmb_kb %zu\n", mb,
+         sizeof(uint64_t) * TRIGRAM_WORDS *
+             (E.trigrams.norig + E.trigrams.nadd) / 1024);
+
+  t = editorNow();
+  editorFindCallback(BENCH_NEEDLE, 'x');
+  ns = editorNow() - t;
+  editorFindCallback(BENCH_NEEDLE, '\r');
+  printf("find_%dmb_indexed_ms %.3f\n", mb, ns / 1e6);
+  benchFindTyped(mb, "indexed_typed");
+}
+
+void benchRowsToString(int mb) {
+  int len;
+  uint64_t t = editorNow();
+  char *buf = editorRowsToString(&len);
+  uint64_t ns = editorNow() - t;
+  free(buf);
+  printf("rows_to_string_%dmb_ms %.3f\n", mb, ns / 1e6);
+}
+
+// replace-all of a common word, every matching row is rebuilt once
+void benchReplace(int mb) {
+  char cmd[] = "%s/render/RENDER/g";
+  int subs = 0;
+  uint64_t t = editorNow();
+  editorCommand(cmd);
+  uint64_t ns = editorNow() - t;
+  sscanf(E.statusmsg, "%d", &subs);
+  printf("replace_%dmb_ms %.3f\n", mb, ns / 1e6);
+  printf("replace_%dmb_subs %d\n", mb, subs);
+}
+
+void benchRefresh() {
+  int frames = 2000;
+  int j;
+  uint64_t t, ns;
+
+  // full frames, the terminal is assumed to show nothing we drew
+  long long bytes = E.bench->bytes;
+  t = editorNow();
+  for (j = 0; j < frames; j++) {
+    memset(E.shown.chars, '\0', E.shown.rows * E.shown.cols);
+    editorRefreshScreen();
+  }
+  ns = editorNow() - t;
+  printf("refresh_full_us %.2f\n", ns / 1e3 / frames);
+  printf("refresh_full_bytes %.0f\n",
+         (double)(E.bench->bytes - bytes) / frames);
+
+  // scrolling one line per frame
+  bytes = E.bench->bytes;
+  t = editorNow();
+  for (j = 0; j < frames; j++) {
+    E.cy = E.rowoff + E.screenrows;
+    if (E.cy >= E.numrows)
+      E.cy = 0;
+    editorRefreshScreen();
+  }
+  ns = editorNow() - t;
+  printf("refresh_scroll_us %.2f\n", ns / 1e3 / frames);
+  printf("refresh_scroll_bytes %.0f\n",
+         (double)(E.bench->bytes - bytes) / frames);
+
+  // nothing changed
+  bytes = E.bench->bytes;
+  t = editorNow();
+  for (j = 0; j < frames; j++)
+    editorRefreshScreen();
+  ns = editorNow() - t;
+  printf("refresh_idle_us %.2f\n", ns / 1e3 / frames);
+  printf("refresh_idle_bytes %.0f\n",
+         (double)(E.bench->bytes - bytes) / frames);
+  printf("output_allocs %d\n", E.out.allocs);
+}
+
+// open a block comment at the top of the file, move a few thousand rows
+// down, then jump to its end. only the first screen is lexed at once. the
+// move and the jump are drawn right away and the background highlighter
+// walks the rows in between, which the editor lets it do while it waits
+// for keys. closing the comment again walks them without the worker
+void benchComment(char *path, int mb) {
+  editorOpen(path);
+  trigramFree();
+  E.syntax = &HLDB[0];
+  editorRefreshScreen();
+
+  uint64_t t = editorNow();
+  editorInsertChar('/');
+  editorInsertChar('*');
+  editorRefreshScreen();
+  uint64_t ns = editorNow() - t;
+  printf("comment_open_%dmb_us %.2f\n", mb, ns / 1e3);
+
+  hlWorkerStart();
+  t = editorNow();
+  E.cy = 3000 < E.numrows ? 3000 : E.numrows - 1;
+  editorRefreshScreen();
+  ns = editorNow() - t;
+  printf("comment_page_%dmb_us %.2f\n", mb, ns / 1e3);
+  t = editorNow();
+  E.cy = E.numrows - 1;
+  editorRefreshScreen();
+  ns = editorNow() - t;
+  printf("comment_jump_%dmb_us %.2f\n", mb, ns / 1e3);
+  t = editorNow();
+  struct timespec idle = {0, 1000000};
+  while (E.hlvalid < E.numrows) {
+    pthread_mutex_unlock(&E.hlw.lock);
+    nanosleep(&idle, NULL);
+    pthread_mutex_lock(&E.hlw.lock);
+  }
+  ns = editorNow() - t;
+  printf("comment_background_%dmb_ms %.3f\n", mb, ns / 1e6);
+  hlWorkerStop();
+
+  E.cy = 0;
+  E.cx = 2;
+  editorRefreshScreen();
+  editorDelChar();
+  editorDelChar();
+  editorRefreshScreen();
+  t = editorNow();
+  E.cy = E.numrows - 1;
+  editorRefreshScreen();
+  ns = editorNow() - t;
+  printf("comment_walk_%dmb_ms %.3f\n", mb, ns / 1e6);
+}
+
+// type a long line at the end of the file, the row grows in its slack
+void benchType(int mb) {
+  int iters = 100000;
+  uint64_t moves = E.tb.arena.moves;
+  editorInsertRow(E.numrows, "", 0);
+  E.cy = E.numrows - 1;
+  E.cx = 0;
+  uint64_t t = editorNow();
+  int j;
+  for (j = 0; j < iters; j++)
+    editorInsertChar('x');
+  uint64_t ns = editorNow() - t;
+  printf("type_%dmb_ns %.1f\n", mb, (double)ns / iters);
+  printf("type_%dmb_moves %llu\n", mb,
+         (unsigned long long)(E.tb.arena.moves - moves));
+  editorDelRow(E.numrows - 1);
+  E.cy = E.cx = 0;
+}
+
+// what the benchmarks before left in the row arena
+void benchArena(int mb) {
+  struct rowArena *a = &E.tb.arena;
+  printf("arena_%dmb_slabs %d\n", mb, a->nslabs);
+  printf("arena_%dmb_live_kb %zu\n", mb, a->live >> 10);
+  printf("arena_%dmb_large_kb %zu\n", mb, a->largebytes >> 10);
+  printf("arena_%dmb_allocs %llu\n", mb, (unsigned long long)a->allocs);
+  printf("arena_%dmb_reused %llu\n", mb, (unsigned long long)a->reused);
+  printf("arena_%dmb_grows %llu\n", mb, (unsigned long long)a->grows);
+  printf("arena_%dmb_moves %llu\n", mb, (unsigned long long)a->moves);
+}
+
+// rows are dropped with the arena, not one by one
+void benchClose(int mb) {
+  uint64_t t = editorNow();
+  editorCloseFile();
+  uint64_t ns = editorNow() - t;
+  printf("close_%dmb_ms %.3f\n", mb, ns / 1e6);
+}
+
+/*** main ***/
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s <dir> <size in MB>...\n", argv[0]);
+    return 1;
+  }
+
+  // frames are counted instead of written, see editorWrite
+  static struct benchState b;
+  E.bench = &b;
+  initEditor();
+
+  printf("version %s\n", KILO_VERSION);
+  benchUpdateRow();
+
+  int i;
+  for (i = 2; i < argc; i++) {
+    int mb = atoi(argv[i]);
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/kilo-bench-%dmb.txt", argv[1], mb);
+    benchGenerate(path, (size_t)mb * 1024 * 1024);
+
+    benchOpen(path, mb);
+    benchFiletype(mb);
+    benchFind(mb);
+    benchFindTyped(mb, "typed");
+    benchSearchEngine(mb);
+    benchHighlight(mb);
+    benchFindRegex(mb);
+    benchTrigrams(mb);
+    benchRowsToString(mb);
+    benchReplace(mb);
+    if (i == 2)
+      benchRefresh();
+    benchType(mb);
+    benchArena(mb);
+    benchClose(mb);
+    benchComment(path, mb);
+    editorCloseFile();
+  }
+  return 0;
+}
@@ -0,0 +1,134 @@
+// keywords of the languages in HLDB
+// kwgen turns every list into a perfect hash table at build time and
+// writes them to keywords_hash.h, which kilo.c includes. looking a word up
+// costs two loads, one hash and one compare however long the list is
+
+#ifndef KEYWORDS_H
+#define KEYWORDS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+enum keywordClass { KW_NONE = 0, KW_KEYWORD, KW_TYPE };
+
+// a word is read as a 16 byte key padded with zeros and hashed once. it
+// goes to bucket kwSlot(h, 0) & bmask and then to slot
+// kwSlot(h, disp[bucket]) & mask, kwgen picks disp so no two words share a
+// slot. words outside minlen..maxlen are never looked up
+struct keywordTable {
+  const char (*words)[16]; // zeros for empty slots
+  const unsigned char *cls; // KW_* of each slot
+  const uint16_t *disp;
+  uint32_t bmask;
+  uint32_t mask;
+  int minlen;
+  int maxlen;
+};
+
+// the key of a word of 1 to 16 bytes at s, 16 bytes must be readable there.
+// kwgen runs on the same machine, so both read keys in the same byte order
+static void kwKey(const char *s, int len, uint64_t *key) {
+  memcpy(key, s, 16);
+  key[0] &= len >= 8 ? ~0ULL : (1ULL << len * 8) - 1;
+  key[1] &= len >= 16 ? ~0ULL : len <= 8 ? 0 : (1ULL << (len - 8) * 8) - 1;
+}
+
+static uint32_t kwHash(const uint64_t *key) {
+  uint64_t h = key[0] * 0x9e3779b97f4a7c15ULL ^ key[1] * 0xc2b2ae3d27d4eb4fULL;
+  return h >> 32 ^ h;
+}
+
+static uint32_t kwSlot(uint32_t h, uint32_t d) {
+  h += d * 0x9e3779b9u;
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  return h ^ h >> 13;
+}
+
+#ifdef KWGEN
+// types end in '|'
+static const char *C_HL_keywords[] = {
+    "auto", "break", "case", "const", "continue", "default", "do", "else",
+    "enum", "extern", "for", "goto", "if", "inline", "register", "restrict",
+    "return", "sizeof", "static", "struct", "switch", "typedef", "union",
+    "volatile", "while", "NULL", "true", "false",
+
+    "int|", "long|", "double|", "float|", "char|", "unsigned|", "signed|",
+    "void|", "short|", "_Bool|", "bool|", "size_t|", "ssize_t|", "off_t|",
+    "int8_t|", "int16_t|", "int32_t|", "int64_t|", "uint8_t|", "uint16_t|",
+    "uint32_t|", "uint64_t|", "intptr_t|", "uintptr_t|", "FILE|", NULL};
+
+static const char *CPP_HL_keywords[] = {
+    "auto", "break", "case", "const", "continue", "default", "do", "else",
+    "enum", "extern", "for", "goto", "if", "inline", "register", "return",
+    "sizeof", "static", "struct", "switch", "typedef", "union", "volatile",
+    "while", "class", "namespace", "template", "typename", "public",
+    "private", "protected", "virtual", "override", "final", "new", "delete",
+    "this", "try", "catch", "throw", "using", "operator", "friend",
+    "explicit", "mutable", "constexpr", "consteval", "noexcept", "nullptr",
+    "static_cast", "dynamic_cast", "reinterpret_cast", "const_cast",
+    "decltype", "static_assert", "true", "false",
+
+    "int|", "long|", "double|", "float|", "char|", "unsigned|", "signed|",
+    "void|", "short|", "bool|", "wchar_t|", "char8_t|", "char16_t|",
+    "char32_t|", "size_t|", "int8_t|", "int16_t|", "int32_t|", "int64_t|",
+    "uint8_t|", "uint16_t|", "uint32_t|", "uint64_t|", "string|", "vector|",
+    NULL};
+
+static const char *PY_HL_keywords[] = {
+    "and", "as", "assert", "async", "await", "break", "class", "continue",
+    "def", "del", "elif", "else", "except", "finally", "for", "from",
+    "global", "if", "import", "in", "is", "lambda", "nonlocal", "not", "or",
+    "pass", "raise", "return", "try", "while", "with", "yield", "None",
+    "True", "False", "self",
+
+    "int|", "float|", "complex|", "str|", "bytes|", "bytearray|", "list|",
+    "dict|", "set|", "frozenset|", "tuple|", "bool|", "object|", "type|",
+    NULL};
+
+static const char *GO_HL_keywords[] = {
+    "break", "case", "chan", "const", "continue", "default", "defer", "else",
+    "fallthrough", "for", "func", "go", "goto", "if", "import", "interface",
+    "map", "package", "range", "return", "select", "struct", "switch",
+    "type", "var", "nil", "true", "false", "iota",
+
+    "bool|", "byte|", "complex64|", "complex128|", "error|", "float32|",
+    "float64|", "int|", "int8|", "int16|", "int32|", "int64|", "rune|",
+    "string|", "uint|", "uint8|", "uint16|", "uint32|", "uint64|",
+    "uintptr|", "any|", NULL};
+
+static const char *JS_HL_keywords[] = {
+    "break", "case", "catch", "class", "const", "continue", "debugger",
+    "default", "delete", "do", "else", "export", "extends", "finally", "for",
+    "function", "if", "import", "in", "instanceof", "let", "new", "return",
+    "super", "switch", "this", "throw", "try", "typeof", "var", "void",
+    "while", "with", "yield", "async", "await", "of", "static", "null",
+    "undefined", "true", "false",
+
+    "Array|", "Object|", "String|", "Number|", "Boolean|", "Symbol|",
+    "BigInt|", "Map|", "Set|", "WeakMap|", "WeakSet|", "Promise|", "Date|",
+    "RegExp|", "Error|", NULL};
+
+static const char *RS_HL_keywords[] = {
+    "as", "break", "const", "continue", "crate", "else", "enum", "extern",
+    "fn", "for", "if", "impl", "in", "let", "loop", "match", "mod", "move",
+    "mut", "pub", "ref", "return", "self", "Self", "static", "struct",
+    "super", "trait", "type", "unsafe", "use", "where", "while", "async",
+    "await", "dyn", "true", "false",
+
+    "i8|", "i16|", "i32|", "i64|", "i128|", "isize|", "u8|", "u16|", "u32|",
+    "u64|", "u128|", "usize|", "f32|", "f64|", "bool|", "char|", "str|",
+    "String|", "Vec|", "Option|", "Result|", "Box|", NULL};
+
+// table name in keywords_hash.h, then the list it is built from
+#define KWGEN_LISTS                                                            \
+  KWGEN_LIST(C_HL, C_HL_keywords)                                              \
+  KWGEN_LIST(CPP_HL, CPP_HL_keywords)                                          \
+  KWGEN_LIST(PY_HL, PY_HL_keywords)                                            \
+  KWGEN_LIST(GO_HL, GO_HL_keywords)                                            \
+  KWGEN_LIST(JS_HL, JS_HL_keywords)                                            \
+  KWGEN_LIST(RS_HL, RS_HL_keywords)
+#endif
+
+#endif
@@ -8,21 +8,36 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "keywords.h"
+#include "keywords_hash.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 /*** defines ***/
 
 #define KILO_VERSION "0.0.1"
 #define KILO_TAB_STOP 8
 #define KILO_QUIT_TIMES 3
+#define KILO_BENCH_ROWS 24
+#define KILO_BENCH_COLS 80
 
 // ctrl-q to quit
 // this macro mimics what ctrl does in terminal by setting top3 msbs to 0
@@ -43,7 +58,19 @@ enum editorKey {
 };
 
 // editor highlight
-enum editorHighlight { HL_NORMAL = 0, HL_NUMBER, HL_MATCH };
+enum editorHighlight {
+  HL_NORMAL = 0,
+  HL_COMMENT,
+  HL_MLCOMMENT,
+  HL_KEYWORD1,
+  HL_KEYWORD2,
+  HL_STRING,
+  HL_NUMBER,
+  HL_MATCH
+};
+
+// lexer state at the end of a row, carried into the next one
+enum editorHlState { HLS_UNKNOWN = -1, HLS_NORMAL = 0, HLS_COMMENT };
 
 // editor modes
 typedef enum emode {
@@ -60,6 +87,59 @@ const char *stringFromEmode(emode mode) {
 }
 
 #define HL_HIGHLIGHT_NUMBERS (1 << 0)
+#define HL_HIGHLIGHT_STRINGS (1 << 1)
+
+// byte classes the highlighter looks up, one bit each
+enum charClass { CC_SEP = 0, CC_DIGIT, CC_START, CC_WORD, CC_NCLASSES };
+
+#define CC_BIT(k) (1 << (k))
+
+// separators end a word, so a digit after one starts a number
+#define CC_IS_SEP(c)                                                           \
+  ((c) == '\0' || (c) == ' ' || ((c) >= '\t' && (c) <= '\r') ||              \
+   (c) == ',' || (c) == '.' || (c) == '(' || (c) == ')' || (c) == '+' ||       \
+   (c) == '-' || (c) == '/' || (c) == '&' || (c) == '=' || (c) == '~' ||       \
+   (c) == '%' || (c) == '<' || (c) == '>' || (c) == '[' || (c) == ']' ||       \
+   (c) == ';')
+
+// keywords are made of these
+#define CC_IS_WORD(c)                                                          \
+  (((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z') ||                 \
+   ((c) >= '0' && (c) <= '9') || (c) == '_')
+
+// s0..s2 are the bytes that may open a comment or string in a syntax,
+// -1 for none. none of them may be a word byte
+#define CC_CLASS(c, s0, s1, s2)                                                \
+  ((CC_IS_SEP(c) ? CC_BIT(CC_SEP) : 0) |                                       \
+   ((c) >= '0' && (c) <= '9' ? CC_BIT(CC_DIGIT) : 0) |                         \
+   ((c) == (s0) || (c) == (s1) || (c) == (s2) ? CC_BIT(CC_START) : 0) |        \
+   (CC_IS_WORD(c) ? CC_BIT(CC_WORD) : 0))
+
+#define CC_ROW(c, s0, s1, s2)                                                  \
+  CC_CLASS(c, s0, s1, s2), CC_CLASS(c + 1, s0, s1, s2),                        \
+      CC_CLASS(c + 2, s0, s1, s2), CC_CLASS(c + 3, s0, s1, s2),                \
+      CC_CLASS(c + 4, s0, s1, s2), CC_CLASS(c + 5, s0, s1, s2),                \
+      CC_CLASS(c + 6, s0, s1, s2), CC_CLASS(c + 7, s0, s1, s2),                \
+      CC_CLASS(c + 8, s0, s1, s2), CC_CLASS(c + 9, s0, s1, s2),                \
+      CC_CLASS(c + 10, s0, s1, s2), CC_CLASS(c + 11, s0, s1, s2),              \
+      CC_CLASS(c + 12, s0, s1, s2), CC_CLASS(c + 13, s0, s1, s2),              \
+      CC_CLASS(c + 14, s0, s1, s2), CC_CLASS(c + 15, s0, s1, s2)
+
+// class of all 256 bytes, worked out by the compiler
+#define CC_TABLE(s0, s1, s2)                                                   \
+  {                                                                            \
+    CC_ROW(0x00, s0, s1, s2), CC_ROW(0x10, s0, s1, s2),                        \
+        CC_ROW(0x20, s0, s1, s2), CC_ROW(0x30, s0, s1, s2),                    \
+        CC_ROW(0x40, s0, s1, s2), CC_ROW(0x50, s0, s1, s2),                    \
+        CC_ROW(0x60, s0, s1, s2), CC_ROW(0x70, s0, s1, s2),                    \
+        CC_ROW(0x80, s0, s1, s2), CC_ROW(0x90, s0, s1, s2),                    \
+        CC_ROW(0xa0, s0, s1, s2), CC_ROW(0xb0, s0, s1, s2),                    \
+        CC_ROW(0xc0, s0, s1, s2), CC_ROW(0xd0, s0, s1, s2),                    \
+        CC_ROW(0xe0, s0, s1, s2), CC_ROW(0xf0, s0, s1, s2)                     \
+  }
+
+// cell attributes are an sgr foreground color (0 for default) plus flags
+#define ATTR_INVERSE 0x80
 
 /*** data ***/
 
@@ -67,18 +147,278 @@ const char *stringFromEmode(emode mode) {
 struct editorSyntax {
   char *filetype;
   char **filematch;
+  char *singleline_comment_start;
+  char *multiline_comment_start;
+  char *multiline_comment_end;
   int flags;
+  const struct keywordTable *keywords; // generated from keywords.h
+  unsigned char *classes; // CC_* bits of every byte, see CC_TABLE
+  // the same classes split by nibble: a byte is in class k when the entries
+  // for its low and high nibble share a bit. built by editorSyntaxInit
+  unsigned char nibbles[CC_NCLASSES][2][16];
+  int vector; // widest classifier the cpu and tables allow, see HL_VEC_*
 };
 
 // stores a line of text
 typedef struct erow {
   int size;
   int rsize; // render size
+  int dirty; // render and hl are stale, see editorRowRender
   char *chars;
   char *render;      // render char array
   unsigned char *hl; // store row highlight info
+  unsigned int matchgen; // E.matchgen matches were found for, 0 if stale
+  int *matches;          // chars offsets where matches start and end
+  int nmatches;
+  int *tabs;  // per tab in chars: its offset, then the render column after it
+  int ntabs;
+  int src; // buffer and index of the row, its lexer state is kept there
+  int idx;
 } erow;
 
+// row storage: chars, render, hl, tabs and matches of every row come from
+// 1MB slabs cut into power of two blocks, so a row has room to grow in
+// and typing only moves it when it doubles. freed blocks go on a list per
+// size, blocks over ARENA_MAX_SHIFT come from malloc. closing the buffer
+// drops the slabs in one go instead of freeing row by row
+#define ARENA_MIN_SHIFT 4
+#define ARENA_MAX_SHIFT 16
+#define ARENA_SLAB (1 << 20)
+#define ARENA_LARGE (ARENA_MAX_SHIFT + 1) // class of malloc'ed blocks
+
+// every block starts with its class, the caller gets what follows
+struct arenaBlock {
+  union {
+    struct arenaBlock *next; // while on a free list
+    uint64_t cls;
+  } u;
+};
+
+struct arenaLarge {
+  struct arenaLarge *prev;
+  struct arenaLarge *next;
+  size_t size; // usable bytes
+  struct arenaBlock head;
+};
+
+struct rowArena {
+  char **slabs;
+  int nslabs;
+  int slabcap;
+  char *bump; // unused end of the last slab
+  char *bumpend;
+  struct arenaBlock *free[ARENA_MAX_SHIFT + 1];
+  struct arenaLarge *large;
+  // stats, see benchArena
+  uint64_t allocs; // blocks handed out
+  uint64_t reused; // of those, taken off a free list
+  uint64_t grows;  // resizes that fit in the block they had
+  uint64_t moves;  // resizes that needed a bigger block
+  size_t live;     // usable bytes of blocks handed out
+  size_t largebytes;
+};
+
+// piece table over rows
+// rows read by editorOpen go to the original buffer and rows created while
+// editing are appended to the add buffer. neither buffer is ever shifted,
+// the document is the list of pieces, each one a run of consecutive rows in
+// one of the buffers. inserting or deleting a line only splits a piece, so
+// the cost depends on the number of edits and not on the size of the file
+enum pieceSource { PIECE_ORIG = 0, PIECE_ADD };
+
+typedef struct piece {
+  int src;   // buffer the rows come from
+  int start; // index of first row in that buffer
+  int len;   // number of rows in the run
+} piece;
+
+// rows of one buffer. what scans over many rows need is kept in arrays of
+// its own, so they stream through a few bytes per row. an erow is only
+// made once a row is edited or drawn, see tbRowAt
+struct rowTable {
+  erow **rows;        // NULL while the row is only text in map
+  signed char *hlin;  // lexer state hl and hlend were built from
+  signed char *hlend; // lexer state after the row, HLS_UNKNOWN once it changes
+  unsigned int *gen;  // bumped on every edit, see hlCommit
+  int len;
+  int cap;
+};
+
+// position in the piece list, lets a walk over rows resume where the last
+// lookup ended instead of starting from the first piece
+struct tbCursor {
+  int piece;
+  int row; // document row where the piece starts
+};
+
+struct textBuffer {
+  struct rowTable orig; // rows loaded from file
+  char *map; // text read by editorOpen, backs unmodified orig rows
+  size_t maplen;
+  int mapfile;       // map is an mmap of the file rather than a copy
+  uint64_t *lineoff; // start of each orig row in map, see editorIndexLines
+  int nlines;
+  int hascr; // map has '\r' line endings, trimmed off its rows
+  // bit per orig row that got chars of its own. the others are still the
+  // text at lineoff in map, scans read them from there, see tbText
+  uint64_t *origown;
+  int nown; // bits set in origown
+  struct rowTable add; // rows created by edits, append only
+  piece *pieces; // document order
+  int npieces;
+  int piececap;
+  struct tbCursor hint; // last lookup, most accesses are sequential
+  struct rowArena arena; // storage of all rows, freed with the buffer
+};
+
+// we do this to avoid doing so many writes
+// just append to this buffer and write once
+// dynamic string buffer with append method
+struct abuf {
+  char *b;
+  int len;
+  int cap;
+  int allocs; // times b was (re)allocated
+};
+
+#define ABUF_INIT                                                              \
+  { NULL, 0, 0, 0 }
+
+// threads started on first use, one per core besides the main thread
+// editorParallel hands out task numbers until all are done
+struct workerPool {
+  pthread_t *threads;
+  int nthreads;
+  pthread_mutex_t lock;
+  pthread_cond_t work; // new tasks were posted
+  pthread_cond_t done; // last task of a batch finished
+  void (*fn)(void *arg, int task);
+  void *arg;
+  int ntasks;
+  int next;    // next task to hand out
+  int pending; // tasks not finished yet
+};
+
+// blocks of consecutive rows from the same source buffer, each with a
+// bitmap of hashed trigrams found in it. bits are only ever set, so a
+// block may claim trigrams its rows lost but never misses one they have
+#define TRIGRAM_MIN_BYTES (64 << 20) // smaller files scan fast enough
+#define TRIGRAM_BLOCK_ROWS 1024
+#define TRIGRAM_BITS 8192
+#define TRIGRAM_WORDS (TRIGRAM_BITS / 64)
+
+struct trigramIndex {
+  pthread_t thread;
+  pthread_mutex_t lock; // held while the builder or an edit sets bits
+  int running;          // builder thread not joined yet
+  int stop;             // asks the builder to give up
+  int built;            // orig blocks finished by the builder
+  int norig;
+  uint64_t *orig; // TRIGRAM_WORDS per block of orig rows, NULL if no index
+  int nadd;
+  uint64_t *add;
+};
+
+// rows lexed by the background highlighter in one go
+#define HL_BATCH_ROWS 4096
+#define HL_BATCH_BYTES (256 << 10)
+// screens a draw lexes itself, the one shown included
+#define HL_SYNC_SCREENS 2
+
+// copy of the rows a batch lexes, taken under the lock
+struct hlBatchRow {
+  int src; // buffer and index of the row, these never move
+  int idx;
+  unsigned int gen;
+  int off; // chars in hlBatch.text
+  int size;
+  int hlin;
+  int hlend;
+};
+
+struct hlBatch {
+  struct editorSyntax *syntax;
+  unsigned int layoutgen;
+  int first; // document row of rows[0], E.hlvalid when taken
+  int state; // state rows[0] starts in
+  struct hlBatchRow *rows;
+  int nrows;
+  int rowcap;
+  char *text;
+  size_t textlen;
+  size_t textcap;
+};
+
+// thread moving E.hlvalid to the end of the file while the editor waits
+// for keys. the main thread holds lock except inside editorReadByte, so
+// the worker only copies rows and stores results when the editor is idle
+// and lexes with the lock released
+struct hlWorker {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake; // the frontier moved back or the screen moved
+  int running;
+  int stop;
+  int redraw; // rows on screen got their state since the last frame
+};
+
+// a query compiled once and then run over many rows, see searchCompile
+struct searchQuery {
+  const char *pat;
+  int len;
+  int avx2;      // cpu has avx2, checked once per compile
+  int skip[256]; // horspool shift for each byte under the pattern end
+  struct regex *re; // compiled pattern in regex mode, see regexCompile
+  int invalid;      // regex that did not compile, it matches nothing
+};
+
+// rows matching each query typed so far in the search prompt
+// every level is a subset of the one below it, so typing a char only
+// re-checks the rows of the previous level and deleting one pops back to it
+struct searchLevel {
+  char *query;
+  int *rows; // sorted
+  int nrows;
+  // where the first match in each row starts, NULL in regex mode. a
+  // longer query can't match before its prefix did, so the next level
+  // starts looking there and mostly finds it right away
+  int *offs;
+};
+
+struct searchCache {
+  struct searchLevel *levels;
+  int nlevels;
+  int cap;
+};
+
+// one terminal screen worth of cells
+// text and attributes are kept in separate arrays so a whole row can be
+// compared with memcmp
+struct screen {
+  int rows;
+  int cols;
+  int rowoff; // E.rowoff the text rows were drawn at
+  char *chars;
+  unsigned char *attrs; // see ATTR_* and editorAttrToSgr
+};
+
+// state of a --bench run
+// keys come from a script instead of the terminal and frames are only
+// counted, see editorBench
+struct benchState {
+  char *script; // key bytes, fed to editorReadKey as typed
+  size_t len;
+  size_t pos;
+  long keys;
+  long frames;
+  long long bytes;   // frame output that would have gone to the terminal
+  uint64_t *lat;     // ns per editorProcessKeypress + editorRefreshScreen
+  int nlat;
+  int latcap;
+  uint64_t start;    // ns when the first key was read
+  uint64_t opentime; // ns spent in editorOpen
+};
+
 struct editorConfig {
   int cx, cy;            // cursor x,y for char array
   int rx;                // render x position
@@ -87,12 +427,28 @@ struct editorConfig {
   int screenrows;        // number of rows on screen
   int screencols;        // number of columns on screen
   int numrows;           // number of rows in file
-  erow *row;             // array of edtiro rows to hold rows of chars
+  struct textBuffer tb;  // rows of chars in document order
   int dirty;             // set if buffer has been modified since last save
   char *filename;        // name of file opened in buffer
   char statusmsg[80];    // hold status bar message
   time_t statusmsg_time; // hold status bar message displayed time
   emode mode;            // hold current mode
+  struct screen frame;   // cells of the frame being drawn
+  struct screen shown;   // cells the terminal is showing right now
+  struct abuf out;       // output of editorRefreshScreen, kept between frames
+  struct benchState *bench; // non NULL when running headless with --bench
+  struct searchCache search; // match sets of the current search prompt
+  struct workerPool pool;
+  struct trigramIndex trigrams; // built for big files, see trigramStart
+  int hlsearch;          // paint every match of the last search on screen
+  char *hlquery;         // query being painted, NULL if none
+  struct searchQuery hlq;
+  int regex;             // search queries are regular expressions
+  unsigned int matchgen; // bumped when hlquery changes, see erow.matchgen
+  struct editorSyntax *syntax; // NULL if the filetype is unknown
+  int hlvalid;           // rows before this one have an up to date hlend
+  unsigned int layoutgen; // bumped when rows are inserted or deleted
+  struct hlWorker hlw;
   struct termios orig_termios;
 };
 
@@ -110,16 +466,113 @@ void die(const char *s) {
 
 /*** filetypes ***/
 
-char *C_HL_extension[] = {".c", ".h", ".cpp", NULL};
+// the start bytes in a class table have to cover the first byte of every
+// comment delimiter and the quotes if strings are highlighted
+// filematch entries are extensions with their dot, interpreters of a
+// shebang line after "#!", modeline names after "ft:" besides the
+// filetype itself, or else whole file names
+char *C_HL_extension[] = {".c", ".h", NULL};
+char *CPP_HL_extension[] = {".cpp", ".hpp", ".cc", ".cxx", ".hh", "ft:c++",
+                            NULL};
+char *PY_HL_extension[] = {".py", ".pyw", "#!python", NULL};
+char *GO_HL_extension[] = {".go", NULL};
+char *JS_HL_extension[] = {".js", ".mjs", ".cjs", "#!node", "ft:js", NULL};
+char *RS_HL_extension[] = {".rs", NULL};
+
+unsigned char C_HL_classes[256] = CC_TABLE('/', '"', '\'');
+unsigned char PY_HL_classes[256] = CC_TABLE('#', '"', '\'');
+// a quote in rust is more often a lifetime than a char, leave it alone
+unsigned char RS_HL_classes[256] = CC_TABLE('/', '"', -1);
 
 struct editorSyntax HLDB[] = {
-    {"c", C_HL_extension, HL_HIGHLIGHT_NUMBERS},
+    {.filetype = "c",
+     .filematch = C_HL_extension,
+     .singleline_comment_start = "//",
+     .multiline_comment_start = "/*",
+     .multiline_comment_end = "*/",
+     .flags = HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+     .keywords = &C_HL_kw,
+     .classes = C_HL_classes},
+    {.filetype = "cpp",
+     .filematch = CPP_HL_extension,
+     .singleline_comment_start = "//",
+     .multiline_comment_start = "/*",
+     .multiline_comment_end = "*/",
+     .flags = HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+     .keywords = &CPP_HL_kw,
+     .classes = C_HL_classes},
+    {.filetype = "python",
+     .filematch = PY_HL_extension,
+     .singleline_comment_start = "#",
+     .flags = HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+     .keywords = &PY_HL_kw,
+     .classes = PY_HL_classes},
+    {.filetype = "go",
+     .filematch = GO_HL_extension,
+     .singleline_comment_start = "//",
+     .multiline_comment_start = "/*",
+     .multiline_comment_end = "*/",
+     .flags = HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+     .keywords = &GO_HL_kw,
+     .classes = C_HL_classes},
+    {.filetype = "javascript",
+     .filematch = JS_HL_extension,
+     .singleline_comment_start = "//",
+     .multiline_comment_start = "/*",
+     .multiline_comment_end = "*/",
+     .flags = HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+     .keywords = &JS_HL_kw,
+     .classes = C_HL_classes},
+    {.filetype = "rust",
+     .filematch = RS_HL_extension,
+     .singleline_comment_start = "//",
+     .multiline_comment_start = "/*",
+     .multiline_comment_end = "*/",
+     .flags = HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+     .keywords = &RS_HL_kw,
+     .classes = RS_HL_classes},
+};
+
+#define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
+
+// filetype map, built from HLDB once at startup. a file is matched by
+// a handful of probes however many entries HLDB has
+#define FT_SLOTS 256 // power of two, ftInit checks it is twice the keys
+#define FT_SNIFF_BYTES 4096 // only the first page is looked at
+#define FT_MODELINES 5
+
+// what a filematch entry is matched against
+enum ftKind { FT_EXT = 0, FT_NAME, FT_INTERP, FT_MODE };
+
+struct ftSlot {
+  const char *key; // NULL for free slots
+  int len;
+  int kind;
+  struct editorSyntax *syntax;
 };
 
+struct ftSlot ftMap[FT_SLOTS];
+
 /*** prototypes ***/
 void editorSetStatusMessage(const char *fmt, ...);
+void editorSetHighlight(char *query);
+erow *editorRowRender(erow *row);
+erow *tbRowAt(struct textBuffer *tb, struct tbCursor *c, int at);
+struct rowTable *tbTable(struct textBuffer *tb, int src);
+int tbLocate(struct textBuffer *tb, struct tbCursor *c, int at, int *idx);
+const char *tbRowText(struct textBuffer *tb, int src, int idx, int *size);
 void editorRefreshScreen();
 char *editorPrompt(char *prompt, void (*callback)(char *, int));
+void editorReplace(char *cmd);
+void trigramStart();
+void trigramStop();
+void trigramResume();
+void trigramFree();
+int tbFind(struct textBuffer *tb, struct tbCursor *c, int at, int *off);
+void hlWorkerWake();
+void trigramAddText(erow *row, int from, int to);
+void *arenaAlloc(struct rowArena *a, size_t n);
+void *arenaReserve(struct rowArena *a, void *p, size_t n);
 
 /*** terminal ***/
 
@@ -169,25 +622,62 @@ void enableRawMode() {
     die("tcsetattr");
 }
 
+// read one byte of input, from the key script when benchmarking
+int editorReadByte(char *c) {
+  struct benchState *b = E.bench;
+  if (!b) {
+    // the background highlighter gets the rows while we wait
+    if (E.hlw.running)
+      pthread_mutex_unlock(&E.hlw.lock);
+    int nread = read(STDIN_FILENO, c, 1);
+    if (E.hlw.running)
+      pthread_mutex_lock(&E.hlw.lock);
+    return nread;
+  }
+  if (b->pos == b->len)
+    return 0;
+  *c = b->script[b->pos++];
+  return 1;
+}
+
+// frames go to the terminal, or are only counted when benchmarking
+void editorWrite(const char *s, int len) {
+  if (E.bench) {
+    E.bench->frames++;
+    E.bench->bytes += len;
+    return;
+  }
+  write(STDOUT_FILENO, s, len);
+}
+
 int editorReadKey() {
   int nread;
   char c;
-  while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
+  // a finished script ends the run, the report is printed at exit
+  if (E.bench && E.bench->pos == E.bench->len)
+    exit(0);
+  while ((nread = editorReadByte(&c)) != 1) {
     if (nread == -1 && errno != EAGAIN)
       die("read");
+    if (E.hlw.redraw) {
+      E.hlw.redraw = 0;
+      editorRefreshScreen();
+    }
   }
+  if (E.bench)
+    E.bench->keys++;
 
   if (c == '\x1b') {
     char seq[3];
 
-    if (read(STDIN_FILENO, &seq[0], 1) != 1)
+    if (editorReadByte(&seq[0]) != 1)
       return '\x1b';
-    if (read(STDIN_FILENO, &seq[1], 1) != 1)
+    if (editorReadByte(&seq[1]) != 1)
       return '\x1b';
 
     if (seq[0] == '[') {
       if (seq[1] >= '0' && seq[1] <= '9') {
-        if (read(STDIN_FILENO, &seq[2], 1) != 1)
+        if (editorReadByte(&seq[2]) != 1)
           return '\x1b';
         if (seq[2] == '~') {
           switch (seq[1]) {
@@ -266,6 +756,13 @@ int getCursorPosition(int *rows, int *cols) {
 int getWindowSize(int *rows, int *cols) {
   struct winsize ws;
 
+  // benchmarks always run on the same screen
+  if (E.bench) {
+    *rows = KILO_BENCH_ROWS;
+    *cols = KILO_BENCH_COLS;
+    return 0;
+  }
+
   if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
     // get rows by moving cursor to bottom right
     // 999C -> moves cursor to right by 999
@@ -283,35 +780,680 @@ int getWindowSize(int *rows, int *cols) {
 
 /*** syntax highlighting ***/
 
-int is_seperator(int c) {
-  return isspace(c) || c == '\0' || strchr(",.()+-/&=~%<>[];", c) != NULL;
+enum hlVector { HL_VEC_NONE = 0, HL_VEC_SSSE3, HL_VEC_AVX2 };
+
+// split class k of the byte table by nibble. every high nibble's set of
+// low nibbles gets a bit, equal sets share one. more than 8 distinct sets
+// can't be told apart and the syntax is lexed one byte at a time
+int editorSyntaxNibbles(struct editorSyntax *syn, int k) {
+  unsigned char *lo = syn->nibbles[k][0];
+  unsigned char *hi = syn->nibbles[k][1];
+  uint16_t sets[8];
+  int nsets = 0;
+  int h, l, j;
+  memset(lo, 0, 16);
+  memset(hi, 0, 16);
+  for (h = 0; h < 16; h++) {
+    uint16_t set = 0;
+    for (l = 0; l < 16; l++)
+      if (syn->classes[h * 16 + l] & CC_BIT(k))
+        set |= 1 << l;
+    if (set == 0)
+      continue;
+    for (j = 0; j < nsets && sets[j] != set; j++)
+      ;
+    if (j == nsets) {
+      if (nsets == 8)
+        return 0;
+      sets[nsets++] = set;
+      for (l = 0; l < 16; l++)
+        if (set & (1 << l))
+          lo[l] |= 1 << j;
+    }
+    hi[h] = 1 << j;
+  }
+  return 1;
+}
+
+uint32_t ftHash(const char *key, int len, int kind) {
+  char pad[16] = {0};
+  uint64_t k[2];
+  memcpy(pad, key, len < 16 ? len : 16);
+  kwKey(pad, len < 16 ? len : 16, k);
+  return kwSlot(kwHash(k) ^ len, kind);
 }
 
-void editorUpdateSyntax(erow *row) {
-  row->hl = realloc(row->hl, row->rsize);
-  memset(row->hl, HL_NORMAL, row->size);
+// the first entry for a key wins, as it did when HLDB was searched in order
+void ftAdd(const char *key, int len, int kind, struct editorSyntax *syn) {
+  uint32_t j = ftHash(key, len, kind) & (FT_SLOTS - 1);
+  for (;; j = (j + 1) & (FT_SLOTS - 1)) {
+    struct ftSlot *f = &ftMap[j];
+    if (f->key == NULL) {
+      *f = (struct ftSlot){key, len, kind, syn};
+      return;
+    }
+    if (f->kind == kind && f->len == len && memcmp(f->key, key, len) == 0)
+      return;
+  }
+}
+
+struct editorSyntax *ftFind(const char *key, int len, int kind) {
+  if (len <= 0)
+    return NULL;
+  uint32_t j = ftHash(key, len, kind) & (FT_SLOTS - 1);
+  for (; ftMap[j].key; j = (j + 1) & (FT_SLOTS - 1)) {
+    struct ftSlot *f = &ftMap[j];
+    if (f->kind == kind && f->len == len && memcmp(f->key, key, len) == 0)
+      return f->syntax;
+  }
+  return NULL;
+}
+
+void ftInit() {
+  unsigned int j;
+  // ftAdd and ftFind probe until they hit a free slot, keep half of them
+  // free so there always is one and runs stay short
+  int keys = 0;
+  for (j = 0; j < HLDB_ENTRIES; j++) {
+    char **m;
+    for (keys++, m = HLDB[j].filematch; *m; m++)
+      keys++;
+  }
+  if (keys * 2 > FT_SLOTS) {
+    errno = ENOSPC;
+    die("FT_SLOTS");
+  }
+
+  for (j = 0; j < HLDB_ENTRIES; j++) {
+    struct editorSyntax *syn = &HLDB[j];
+    ftAdd(syn->filetype, strlen(syn->filetype), FT_MODE, syn);
+    char **m;
+    for (m = syn->filematch; *m; m++) {
+      const char *key = *m;
+      int kind = FT_NAME;
+      if (key[0] == '.') {
+        kind = FT_EXT;
+      } else if (strncmp(key, "#!", 2) == 0) {
+        kind = FT_INTERP;
+        key += 2;
+      } else if (strncmp(key, "ft:", 3) == 0) {
+        kind = FT_MODE;
+        key += 3;
+      }
+      ftAdd(key, strlen(key), kind, syn);
+    }
+  }
+}
+
+// derive the vector tables of every HLDB entry, once at startup
+void editorSyntaxInit() {
+  unsigned int j;
+  int k;
+  for (j = 0; j < HLDB_ENTRIES; j++) {
+    struct editorSyntax *syn = &HLDB[j];
+    int ok = 1;
+    for (k = 0; k < CC_NCLASSES; k++)
+      ok &= editorSyntaxNibbles(syn, k);
+    syn->vector = HL_VEC_NONE;
+#if defined(__x86_64__) || defined(__i386__)
+    if (ok && __builtin_cpu_supports("avx2"))
+      syn->vector = HL_VEC_AVX2;
+    else if (ok && __builtin_cpu_supports("ssse3"))
+      syn->vector = HL_VEC_SSSE3;
+#endif
+  }
+  ftInit();
+}
+
+// classifiers fill m[k] with one bit per byte of text[0..63] in class k
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) void
+editorClassifyAvx2(struct editorSyntax *syn, const char *text, uint64_t *m) {
+  __m256i low = _mm256_set1_epi8(0x0f);
+  __m256i zero = _mm256_setzero_si256();
+  __m256i v[2], lo[2], hi[2];
+  int j, k;
+  for (j = 0; j < 2; j++) {
+    v[j] = _mm256_loadu_si256((const __m256i *)(text + j * 32));
+    lo[j] = _mm256_and_si256(v[j], low);
+    hi[j] = _mm256_and_si256(_mm256_srli_epi16(v[j], 4), low);
+  }
+  for (k = 0; k < CC_NCLASSES; k++) {
+    __m256i lt = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)syn->nibbles[k][0]));
+    __m256i ht = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)syn->nibbles[k][1]));
+    uint64_t out = 0;
+    for (j = 0; j < 2; j++) {
+      __m256i c = _mm256_and_si256(_mm256_shuffle_epi8(lt, lo[j]),
+                                   _mm256_shuffle_epi8(ht, hi[j]));
+      uint32_t none = _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, zero));
+      out |= (uint64_t)(uint32_t)~none << (j * 32);
+    }
+    m[k] = out;
+  }
+}
+
+__attribute__((target("ssse3"))) void
+editorClassifySsse3(struct editorSyntax *syn, const char *text, uint64_t *m) {
+  __m128i low = _mm_set1_epi8(0x0f);
+  __m128i zero = _mm_setzero_si128();
+  __m128i v[4], lo[4], hi[4];
+  int j, k;
+  for (j = 0; j < 4; j++) {
+    v[j] = _mm_loadu_si128((const __m128i *)(text + j * 16));
+    lo[j] = _mm_and_si128(v[j], low);
+    hi[j] = _mm_and_si128(_mm_srli_epi16(v[j], 4), low);
+  }
+  for (k = 0; k < CC_NCLASSES; k++) {
+    __m128i lt = _mm_loadu_si128((const __m128i *)syn->nibbles[k][0]);
+    __m128i ht = _mm_loadu_si128((const __m128i *)syn->nibbles[k][1]);
+    uint64_t out = 0;
+    for (j = 0; j < 4; j++) {
+      __m128i c = _mm_and_si128(_mm_shuffle_epi8(lt, lo[j]),
+                                _mm_shuffle_epi8(ht, hi[j]));
+      uint32_t none = _mm_movemask_epi8(_mm_cmpeq_epi8(c, zero));
+      out |= (uint64_t)(~none & 0xffff) << (j * 16);
+    }
+    m[k] = out;
+  }
+}
+#endif
+
+// class of the keyword s[0..len-1], KW_NONE if it is none. avail is how
+// many bytes can be read at s
+int editorKeyword(const struct keywordTable *kw, const char *s, int len,
+                  int avail) {
+  if (len < kw->minlen || len > kw->maxlen)
+    return KW_NONE;
+  char pad[16] = {0};
+  if (avail < 16) {
+    memcpy(pad, s, len);
+    s = pad;
+  }
+  uint64_t key[2], w[2];
+  kwKey(s, len, key);
+  uint32_t h = kwHash(key);
+  uint32_t slot = kwSlot(h, kw->disp[kwSlot(h, 0) & kw->bmask]) & kw->mask;
+  memcpy(w, kw->words[slot], 16);
+  return (w[0] == key[0]) & (w[1] == key[1]) ? kw->cls[slot] : KW_NONE;
+}
+
+// paint the word from text[i] to end if it is a keyword. end may be
+// len, then the word is scanned for here. returns where the word ends
+int editorSyntaxWord(struct editorSyntax *syn, const char *text, int len,
+                     int i, int end, unsigned char *hl) {
+  if (end == len) {
+    end = i;
+    while (end < len &&
+           syn->classes[(unsigned char)text[end]] & CC_BIT(CC_WORD))
+      end++;
+  }
+  int cls = editorKeyword(syn->keywords, &text[i], end - i, len - i);
+  if (cls != KW_NONE)
+    memset(&hl[i], HL_KEYWORD1 + cls - 1, end - i);
+  return end;
+}
+
+// lex up to 64 bytes at text[i] in the normal state, stopping at the
+// first byte that may open a comment or string. returns how many were done
+// numbers are found without a loop: a digit after a separator starts a
+// run, and adding the starts to the digit mask carries through exactly
+// the runs that begin with one and clears them. words are only looked up
+// where one starts, a word byte after a byte that is none
+int editorSyntaxBlock(struct editorSyntax *syn, const char *text, int len,
+                      int i, unsigned char *hl, int *prev_sep, int *prev_num,
+                      int *prev_word) {
+  // most rows are shorter than a block, their tail is classified from a
+  // copy padded with blanks since reading past the row may fault
+  int avail = len - i < 64 ? len - i : 64;
+  const char *p = text + i;
+  char pad[64];
+  if (avail < 64) {
+    memset(pad, ' ', sizeof(pad));
+    memcpy(pad, p, avail);
+    p = pad;
+  }
+
+  uint64_t m[CC_NCLASSES];
+#if defined(__x86_64__) || defined(__i386__)
+  if (syn->vector == HL_VEC_AVX2)
+    editorClassifyAvx2(syn, p, m);
+  else
+    editorClassifySsse3(syn, p, m);
+#else
+  return 0;
+#endif
+
+  uint64_t start = m[CC_START];
+  int n = start ? __builtin_ctzll(start) : 64;
+  if (n > avail)
+    n = avail;
+  if (n == 0)
+    return 0;
+  uint64_t valid = n == 64 ? ~0ULL : (1ULL << n) - 1;
+
+  uint64_t num = 0;
+  if (syn->flags & HL_HIGHLIGHT_NUMBERS) {
+    uint64_t digit = m[CC_DIGIT] & valid;
+    uint64_t after_sep = m[CC_SEP] << 1 | (uint64_t)*prev_sep;
+    uint64_t starts = digit & (after_sep | (uint64_t)*prev_num);
+    num = digit & ~(digit + starts);
+  }
+  // spread every 8 bits of num over 8 bytes of hl, only x86 gets here so
+  // the low byte of the word is the first one in memory. the bytes are
+  // or'ed in, a keyword running in from the last block is already painted
+  int j;
+  for (j = 0; hl && num && j + 8 <= avail; j += 8) {
+    uint64_t bits = num >> j & 0xff;
+    uint64_t bytes = (bits * 0x0101010101010101ULL) & 0x8040201008040201ULL;
+    bytes = ((bytes + 0x7f7f7f7f7f7f7f7fULL) >> 7 & 0x0101010101010101ULL) *
+            HL_NUMBER;
+    uint64_t old;
+    memcpy(&old, &hl[i + j], 8);
+    old |= bytes;
+    memcpy(&hl[i + j], &old, 8);
+  }
+  for (; hl && j < n; j++)
+    if (num >> j & 1)
+      hl[i + j] = HL_NUMBER;
+
+  uint64_t word = m[CC_WORD];
+  if (hl && syn->keywords) {
+    // a word ending in the block ends at the next clear bit, one that
+    // may run past it is scanned for in the row itself
+    uint64_t starts = word & ~m[CC_DIGIT] & ~(word << 1 | (uint64_t)*prev_word);
+    starts &= valid;
+    while (starts) {
+      int at = __builtin_ctzll(starts);
+      starts &= starts - 1;
+      uint64_t rest = ~word >> at;
+      int end = rest ? i + at + __builtin_ctzll(rest) : len;
+      editorSyntaxWord(syn, text, len, i + at, end, hl);
+    }
+  }
+  *prev_sep = m[CC_SEP] >> (n - 1) & 1;
+  *prev_num = num >> (n - 1) & 1;
+  *prev_word = word >> (n - 1) & 1;
+  return n;
+}
+
+// does delim start at text[i], an empty delimiter never does
+int editorSyntaxAt(const char *text, int len, int i, const char *delim,
+                   int dlen) {
+  return dlen && i + dlen <= len && memcmp(&text[i], delim, dlen) == 0;
+}
+
+void editorSyntaxPaint(unsigned char *hl, int from, int n, int cls) {
+  if (hl)
+    memset(&hl[from], cls, n);
+}
+
+// lex len bytes of a row that starts in lexer state, returns the state at
+// its end. hl gets the class of every byte, or is NULL when only the state
+// is wanted. tabs are blanks either way, so chars and render end in the
+// same state
+// plain text goes through editorSyntaxBlock 64 bytes at a time, comments
+// are skipped with memchr and the rest is looked up in the class table
+int editorSyntaxLex(struct editorSyntax *syn, const char *text, int len,
+                    int state, unsigned char *hl) {
+  editorSyntaxPaint(hl, 0, len, HL_NORMAL);
+  if (!syn)
+    return HLS_NORMAL;
+
+  char *scs = syn->singleline_comment_start;
+  char *mcs = syn->multiline_comment_start;
+  char *mce = syn->multiline_comment_end;
+  int scslen = scs ? strlen(scs) : 0;
+  int mcslen = mcs ? strlen(mcs) : 0;
+  int mcelen = mce ? strlen(mce) : 0;
 
   // keep tack of wether previoud char was a seperator to determine highlighting
   int prev_sep = 1;
+  int prev_num = 0;
+  int prev_word = 0;
+  int in_string = 0; // quote that opened the string
+  int keywords = hl && syn->keywords;
 
   int i = 0;
-  while (i < row->rsize) {
-    char c = row->render[i];
-    unsigned char prev_hl = (i > 0) ? row->hl[i - 1] : HL_NORMAL;
+  while (i < len) {
+    if (state == HLS_COMMENT) {
+      // only the first byte of the end delimiter can stop the comment
+      const char *p = mcelen ? memchr(&text[i], mce[0], len - i) : NULL;
+      int at = p ? p - text : len;
+      editorSyntaxPaint(hl, i, at - i, HL_MLCOMMENT);
+      i = at;
+      if (editorSyntaxAt(text, len, i, mce, mcelen)) {
+        editorSyntaxPaint(hl, i, mcelen, HL_MLCOMMENT);
+        i += mcelen;
+        state = HLS_NORMAL;
+        prev_sep = 1;
+        prev_num = 0;
+        prev_word = 0;
+      } else if (i < len) {
+        editorSyntaxPaint(hl, i, 1, HL_MLCOMMENT);
+        i++;
+      }
+      continue;
+    }
+
+    char c = text[i];
+    if (in_string) {
+      // an escaped char never ends the string
+      int n = c == '\\' && i + 1 < len ? 2 : 1;
+      editorSyntaxPaint(hl, i, n, HL_STRING);
+      if (c == in_string)
+        in_string = 0;
+      i += n;
+      prev_sep = 1;
+      prev_word = 0;
+      continue;
+    }
+
+    if (syn->vector) {
+      int n = editorSyntaxBlock(syn, text, len, i, hl, &prev_sep, &prev_num,
+                                &prev_word);
+      i += n;
+      if (n)
+        continue;
+    }
+
+    int cls = syn->classes[(unsigned char)c];
+    if (cls & CC_BIT(CC_START)) {
+      if (editorSyntaxAt(text, len, i, scs, scslen)) {
+        editorSyntaxPaint(hl, i, len - i, HL_COMMENT);
+        break;
+      }
+      if (editorSyntaxAt(text, len, i, mcs, mcslen)) {
+        editorSyntaxPaint(hl, i, mcslen, HL_MLCOMMENT);
+        i += mcslen;
+        state = HLS_COMMENT;
+        continue;
+      }
+      if ((syn->flags & HL_HIGHLIGHT_STRINGS) && (c == '"' || c == '\'')) {
+        editorSyntaxPaint(hl, i, 1, HL_STRING);
+        in_string = c;
+        i++;
+        continue;
+      }
+    }
 
-    if (isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) {
-      row->hl[i] = HL_NUMBER;
+    if ((syn->flags & HL_HIGHLIGHT_NUMBERS) && (cls & CC_BIT(CC_DIGIT)) &&
+        (prev_sep || prev_num)) {
+      editorSyntaxPaint(hl, i, 1, HL_NUMBER);
       i++;
       prev_sep = 0;
+      prev_num = 1;
+      prev_word = 1;
       continue;
     }
-    prev_sep = is_seperator(c);
+    if (keywords && (cls & CC_BIT(CC_WORD)) && !(cls & CC_BIT(CC_DIGIT)) &&
+        !prev_word) {
+      i = editorSyntaxWord(syn, text, len, i, len, hl);
+      prev_sep = 0;
+      prev_num = 0;
+      prev_word = 1;
+      continue;
+    }
+    prev_num = 0;
+    prev_sep = (cls & CC_BIT(CC_SEP)) != 0;
+    prev_word = (cls & CC_BIT(CC_WORD)) != 0;
     i++;
   }
+  return state;
+}
+
+// hl is built from the state the row was last lexed in, editorSyntaxSync
+// fixes that state up before the row is drawn
+void editorUpdateSyntax(erow *row) {
+  struct rowTable *t = tbTable(&E.tb, row->src);
+  row->hl = arenaReserve(&E.tb.arena, row->hl, row->rsize);
+  t->hlend[row->idx] = editorSyntaxLex(E.syntax, row->render, row->rsize,
+                                       t->hlin[row->idx], row->hl);
+}
+
+// called with the first row an edit touched, rows from there on may start
+// in a different state now
+void editorSyntaxStale(int at) {
+  if (at < E.hlvalid)
+    E.hlvalid = at < 0 ? 0 : at;
+}
+
+// bring the lexer state of rows up to last-1 up to date
+// the walk starts at the first stale row and only lexes a row again if it
+// was edited or now starts in another state. once the states converge with
+// the stored ones the remaining rows cost a compare each, and rows below
+// the last one asked for are left alone, so opening a comment at the top
+// of a big file only lexes what is on screen. it goes through the state
+// arrays and the text, rows nobody drew never get an erow
+void editorSyntaxSync(int last) {
+  if (last > E.numrows)
+    last = E.numrows;
+  if (last <= E.hlvalid)
+    return;
+
+  struct tbCursor c = {0, 0};
+  int idx;
+  int state = HLS_NORMAL;
+  if (E.hlvalid > 0) {
+    int src = tbLocate(&E.tb, &c, E.hlvalid - 1, &idx);
+    state = tbTable(&E.tb, src)->hlend[idx];
+  }
+  int j;
+  for (j = E.hlvalid; j < last; j++) {
+    int src = tbLocate(&E.tb, &c, j, &idx);
+    struct rowTable *t = tbTable(&E.tb, src);
+    if (t->hlend[idx] == HLS_UNKNOWN || t->hlin[idx] != state) {
+      int size;
+      const char *text = tbRowText(&E.tb, src, idx, &size);
+      t->hlend[idx] = editorSyntaxLex(E.syntax, text, size, state, NULL);
+      // hl was painted from another state, build it again when drawn
+      if (t->hlin[idx] != state && t->rows[idx])
+        t->rows[idx]->dirty = 1;
+      t->hlin[idx] = state;
+    }
+    state = t->hlend[idx];
+  }
+  E.hlvalid = last;
+}
+
+// rows before last are about to be shown. a walk of at most a screenful
+// off screen is done right away, a longer one is left to the background
+// highlighter so the frame never waits on it. rows past the frontier are
+// drawn in the state they had and drawn again once the worker reaches them
+void editorSyntaxWant(int last) {
+  if (!E.hlw.running || last - E.hlvalid <= E.screenrows * HL_SYNC_SCREENS)
+    editorSyntaxSync(last);
+  if (E.hlvalid < E.numrows)
+    hlWorkerWake();
+}
+
+// the word at s, as far as it goes in a modeline or shebang
+int ftWord(const char *s, const char *end) {
+  const char *p = s;
+  while (p < end && (isalnum((unsigned char)*p) || (*p && strchr("_+-.", *p))))
+    p++;
+  return p - s;
+}
+
+// interpreter named by a "#!" line, through env if that is what runs it.
+// versions are dropped so python3.12 is python
+struct editorSyntax *ftShebang(const char *text, const char *end) {
+  if (end - text < 2 || text[0] != '#' || text[1] != '!')
+    return NULL;
+  const char *p = text + 2;
+  const char *eol = memchr(p, '\n', end - p);
+  if (eol)
+    end = eol;
+  for (;;) {
+    while (p < end && (*p == ' ' || *p == '\t'))
+      p++;
+    const char *w = p;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+      p++;
+    if (w == p)
+      return NULL;
+    const char *base = w;
+    const char *q;
+    for (q = w; q < p; q++)
+      if (*q == '/')
+        base = q + 1;
+    int len = p - base;
+    if (base[0] == '-' || (len == 3 && memcmp(base, "env", 3) == 0))
+      continue;
+    while (len > 0 && (isdigit((unsigned char)base[len - 1]) ||
+                       base[len - 1] == '.'))
+      len--;
+    return ftFind(base, len, FT_INTERP);
+  }
+}
+
+int ftPrefix(const char *p, const char *end, const char *s) {
+  int n = strlen(s);
+  return end - p >= n && memcmp(p, s, n) == 0;
+}
+
+// the value of the filetype option in a vim modeline, NULL if line holds
+// none. as in vim the marker starts the line or follows a blank (ex: only
+// the latter) and is followed either by options split by blanks or colons,
+// or by "set" and options split by blanks up to the next colon
+const char *ftVimFiletype(const char *line, const char *eol) {
+  static const char *marks[] = {"vi:", "vim:", "Vim:", "ex:"};
+  static const char *keys[] = {"ft=", "filetype=", "syn=", "syntax="};
+  const char *p;
+  unsigned int k;
+  for (p = line; p < eol; p++) {
+    if (p > line && p[-1] != ' ' && p[-1] != '\t')
+      continue;
+    const char *opt = NULL;
+    for (k = 0; k < sizeof(marks) / sizeof(marks[0]) && !opt; k++)
+      if ((p > line || marks[k][0] != 'e') && ftPrefix(p, eol, marks[k]))
+        opt = p + strlen(marks[k]);
+    if (!opt)
+      continue;
+
+    while (opt < eol && (*opt == ' ' || *opt == '\t'))
+      opt++;
+    int set = 0;
+    if (ftPrefix(opt, eol, "set ") || ftPrefix(opt, eol, "set\t"))
+      set = 4;
+    else if (ftPrefix(opt, eol, "se ") || ftPrefix(opt, eol, "se\t"))
+      set = 3;
+    opt += set;
+    while (opt < eol) {
+      if (*opt == ' ' || *opt == '\t' || (*opt == ':' && !set)) {
+        opt++;
+        continue;
+      }
+      if (*opt == ':')
+        break;
+      const char *w = opt;
+      while (opt < eol && *opt != ' ' && *opt != '\t' && *opt != ':')
+        opt++;
+      for (k = 0; k < sizeof(keys) / sizeof(keys[0]); k++)
+        if (ftPrefix(w, opt, keys[k]))
+          return w + strlen(keys[k]);
+    }
+    return NULL;
+  }
+  return NULL;
+}
+
+// the major mode of an emacs modeline, "-*- name -*-" or variables like
+// "-*- mode: name; coding: utf-8 -*-", NULL if line holds none
+const char *ftEmacsMode(const char *line, const char *eol) {
+  const char *p = memmem(line, eol - line, "-*-", 3);
+  if (!p)
+    return NULL;
+  p += 3;
+  const char *end = memmem(p, eol - p, "-*-", 3);
+  if (!end)
+    return NULL;
+  if (!memchr(p, ':', end - p))
+    return p;
+  while (p < end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == ';'))
+      p++;
+    const char *var = p;
+    while (p < end && *p != ':' && *p != ';')
+      p++;
+    const char *ve = p;
+    while (ve > var && (ve[-1] == ' ' || ve[-1] == '\t'))
+      ve--;
+    if (p < end && *p == ':' && ve - var == 4 && memcmp(var, "mode", 4) == 0)
+      return p + 1;
+    while (p < end && *p != ';')
+      p++;
+  }
+  return NULL;
+}
+
+// filetype set by a vim modeline (ft=, filetype= or syntax=) or by an
+// emacs one (-*- mode: name -*- or -*- name -*-) in the first lines
+struct editorSyntax *ftModeline(const char *text, const char *end) {
+  const char *line = text;
+  int n;
+  for (n = 0; n < FT_MODELINES && line < end; n++) {
+    const char *eol = memchr(line, '\n', end - line);
+    if (!eol)
+      eol = end;
+    const char *name = ftEmacsMode(line, eol);
+    if (!name)
+      name = ftVimFiletype(line, eol);
+    if (name) {
+      while (name < eol && (*name == ' ' || *name == '\t'))
+        name++;
+      // emacs names are written in any case, the map has them in lower
+      char lower[16];
+      int len = ftWord(name, eol);
+      int j;
+      if (len > (int)sizeof(lower))
+        len = 0;
+      for (j = 0; j < len; j++)
+        lower[j] = tolower((unsigned char)name[j]);
+      struct editorSyntax *syn = ftFind(lower, len, FT_MODE);
+      if (syn)
+        return syn;
+    }
+    line = eol + 1;
+  }
+  return NULL;
+}
+
+// pick the syntax for the open file. a modeline in it says best what it
+// is, then its name and extension, then the interpreter of a shebang line.
+// only the first page of the text is read, it is mapped already
+void editorSelectSyntaxHighlight() {
+  E.syntax = NULL;
+  const char *text = E.tb.map;
+  const char *end =
+      text + (E.tb.maplen < FT_SNIFF_BYTES ? E.tb.maplen : FT_SNIFF_BYTES);
+
+  if ((E.syntax = ftModeline(text, end)))
+    return;
+  if (E.filename) {
+    const char *base = strrchr(E.filename, '/');
+    base = base ? base + 1 : E.filename;
+    if ((E.syntax = ftFind(base, strlen(base), FT_NAME)))
+      return;
+    const char *ext = strrchr(base, '.');
+    if (ext && (E.syntax = ftFind(ext, strlen(ext), FT_EXT)))
+      return;
+  }
+  E.syntax = ftShebang(text, end);
 }
 
 int editorSyntaxToColor(int hl) {
   switch (hl) {
+  case HL_COMMENT:
+  case HL_MLCOMMENT:
+    return 36; // cyan
+  case HL_KEYWORD1:
+    return 33; // yellow
+  case HL_KEYWORD2:
+    return 32; // green
+  case HL_STRING:
+    return 35; // magenta
   case HL_NUMBER:
     return 31; // red
   case HL_MATCH:
@@ -321,261 +1463,2407 @@ int editorSyntaxToColor(int hl) {
   }
 }
 
-/*** row operations ***/
+/*** text buffer ***/
 
-int editorRowCxToRx(erow *row, int cx) {
-  // how many tabs up row[cx]
-  int rx = 0;
-  int j;
-  for (j = 0; j < cx; j++) {
-    if (row->chars[j] == '\t') {
-      rx += (KILO_TAB_STOP - 1) - (rx % KILO_TAB_STOP);
-    }
-    rx++;
+// find piece holding document row at, starting from cursor c
+// returns npieces if at is past the last row
+int tbFind(struct textBuffer *tb, struct tbCursor *c, int at, int *off) {
+  int k = c->piece;
+  int row = c->row;
+  if (k >= tb->npieces) {
+    k = 0;
+    row = 0;
+  }
+  while (k > 0 && at < row) {
+    k--;
+    row -= tb->pieces[k].len;
+  }
+  while (k < tb->npieces && at >= row + tb->pieces[k].len) {
+    row += tb->pieces[k].len;
+    k++;
+  }
+  if (k < tb->npieces) {
+    c->piece = k;
+    c->row = row;
   }
-  return rx;
+  *off = at - row;
+  return k;
 }
 
-int editorRowRxToCx(erow *row, int rx) {
-  int cur_rx = 0;
-  int cx;
-  for (cx = 0; cx < row->size; cx++) {
-    if (row->chars[cx] == '\t')
-      cur_rx += (KILO_TAB_STOP - 1) - (cur_rx % KILO_TAB_STOP);
-    cur_rx++;
+struct rowTable *tbTable(struct textBuffer *tb, int src) {
+  return src == PIECE_ORIG ? &tb->orig : &tb->add;
+}
 
-    if (cur_rx > rx)
-      return cx;
-  }
-  return cx;
+// buffer holding document row at, *idx is the row's index in it
+// safe from several threads as long as nothing edits the buffer meanwhile
+int tbLocate(struct textBuffer *tb, struct tbCursor *c, int at, int *idx) {
+  int off;
+  piece *p = &tb->pieces[tbFind(tb, c, at, &off)];
+  *idx = p->start + off;
+  return p->src;
 }
 
-// fill in render array from char
-// substitute for how tabs and control chars should be rendered
-void editorUpdateRow(erow *row) {
-  int tabs = 0;
-  int j;
-  for (j = 0; j < row->size; j++) {
-    if (row->chars[j] == '\t')
-      tabs++;
+// an unedited orig row is read from map through lineoff, safe from
+// several threads like tbLocate
+const char *tbRowText(struct textBuffer *tb, int src, int idx, int *size) {
+  if (src == PIECE_ORIG && !(tb->origown[idx >> 6] >> (idx & 63) & 1)) {
+    const char *s = tb->map + tb->lineoff[idx];
+    const char *e = tb->map + tb->lineoff[idx + 1];
+    if (e > s && e[-1] == '\n')
+      e--;
+    while (tb->hascr && e > s && e[-1] == '\r')
+      e--;
+    *size = e - s;
+    return s;
   }
+  erow *row = tbTable(tb, src)->rows[idx];
+  *size = row->size;
+  return row->chars;
+}
 
-  free(row->render);
-  row->render = malloc(row->size + tabs * (KILO_TAB_STOP - 1) + 1);
+// chars and size of document row at, without making its erow
+const char *tbText(struct textBuffer *tb, struct tbCursor *c, int at,
+                   int *size) {
+  int idx;
+  int src = tbLocate(tb, c, at, &idx);
+  return tbRowText(tb, src, idx, size);
+}
 
-  int idx = 0;
-  for (j = 0; j < row->size; j++) {
-    if (row->chars[j] == '\t') {
-      row->render[idx++] = ' ';
-      while (idx % KILO_TAB_STOP != 0)
-        row->render[idx++] = ' ';
-    } else {
-      row->render[idx++] = row->chars[j];
-    }
-  }
-  row->render[idx] = '\0';
-  row->rsize = idx;
+// empty erow for row idx of src, only the main thread may make rows
+erow *tbNewRow(struct textBuffer *tb, int src, int idx) {
+  erow *row = arenaAlloc(&tb->arena, sizeof(erow));
+  memset(row, 0, sizeof(erow));
+  row->src = src;
+  row->idx = idx;
+  row->dirty = 1;
+  tbTable(tb, src)->rows[idx] = row;
+  return row;
+}
 
-  editorUpdateSyntax(row);
+// row lookup with a caller owned cursor. only unedited orig rows can lack
+// an erow, theirs is made here with chars still in map. the pointer stays
+// valid until the row is deleted
+erow *tbRowAt(struct textBuffer *tb, struct tbCursor *c, int at) {
+  int idx;
+  int src = tbLocate(tb, c, at, &idx);
+  erow *row = tbTable(tb, src)->rows[idx];
+  if (row)
+    return row;
+  row = tbNewRow(tb, src, idx);
+  row->chars = (char *)tbRowText(tb, src, idx, &row->size);
+  return row;
 }
 
-// append row with given string and size
-// sizeof(E.row[i].chars will be E.row[i].size + 1
-// since we append null at the end of it
-void editorInsertRow(int at, char *s, size_t len) {
-  if (at < 0 || at > E.numrows)
-    return;
+erow *tbRow(struct textBuffer *tb, int at) {
+  return tbRowAt(tb, &tb->hint, at);
+}
 
-  E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
-  memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
+// does row still point into map, then it has to be copied before writing
+int tbMapped(struct textBuffer *tb, erow *row) {
+  int j = row->idx;
+  return row->src == PIECE_ORIG && !(tb->origown[j >> 6] >> (j & 63) & 1);
+}
 
-  E.row[at].size = len;
-  // reading each line calls malloc and out whole file is not in a contigious
-  // chunk of memory. but we use abBuffer for editorDrawRows so it will
-  // end up in the same place
-  E.row[at].chars = malloc(len + 1);
-  memcpy(E.row[at].chars, s, len);
-  E.row[at].chars[len] = '\0';
+void tbOwn(struct textBuffer *tb, erow *row) {
+  int j = row->idx;
+  tb->origown[j >> 6] |= 1ULL << (j & 63);
+  tb->nown++;
+}
 
-  // init render vals
-  E.row[at].rsize = 0;
-  E.row[at].render = NULL;
-  E.row[at].hl = NULL;
-  editorUpdateRow(&E.row[at]);
+// room for cap rows in every array of t
+void tbGrow(struct rowTable *t, int cap) {
+  t->rows = realloc(t->rows, sizeof(erow *) * cap);
+  t->hlin = realloc(t->hlin, cap);
+  t->hlend = realloc(t->hlend, cap);
+  t->gen = realloc(t->gen, sizeof(unsigned int) * cap);
+  t->cap = cap;
+}
 
-  E.numrows++;
-  E.dirty++;
+void tbFreeTable(struct rowTable *t) {
+  free(t->rows);
+  free(t->hlin);
+  free(t->hlend);
+  free(t->gen);
 }
 
-void editorFreeRow(erow *row) {
-  free(row->render);
-  free(row->chars);
-  free(row->hl);
+// how many document rows from at, up to max, are unedited rows that follow
+// each other in map. their text with line endings is map[*from..*to)
+int tbSpan(struct textBuffer *tb, struct tbCursor *c, int at, int max,
+           size_t *from, size_t *to) {
+  int off;
+  int k = tbFind(tb, c, at, &off);
+  if (k == tb->npieces || tb->pieces[k].src != PIECE_ORIG)
+    return 0;
+  piece *p = &tb->pieces[k];
+  int first = p->start + off;
+  int limit = p->len - off < max ? p->len - off : max;
+  int n = 0;
+  // 64 rows per word of the bitmap
+  while (n < limit) {
+    int j = first + n;
+    uint64_t own = tb->origown[j >> 6] >> (j & 63);
+    if (own & 1)
+      break;
+    n += own ? __builtin_ctzll(own) : 64 - (j & 63);
+  }
+  if (n > limit)
+    n = limit;
+  *from = tb->lineoff[first];
+  *to = tb->lineoff[first + n];
+  return n;
 }
 
-void editorDelRow(int at) {
-  if (at < 0 || at >= E.numrows)
+// make room for n pieces starting at pieces[k]
+void tbOpenPieces(struct textBuffer *tb, int k, int n) {
+  if (tb->npieces + n > tb->piececap) {
+    tb->piececap = tb->piececap ? tb->piececap * 2 : 16;
+    tb->pieces = realloc(tb->pieces, sizeof(piece) * tb->piececap);
+  }
+  memmove(&tb->pieces[k + n], &tb->pieces[k],
+          sizeof(piece) * (tb->npieces - k));
+  tb->npieces += n;
+}
+
+// insert an empty row at document row at, taken from the end of src buffer
+erow *tbInsert(struct textBuffer *tb, int at, int src) {
+  struct rowTable *t = tbTable(tb, src);
+  // both buffers grow geometrically so appending a row is amortized O(1)
+  if (t->len == t->cap)
+    tbGrow(t, t->cap ? t->cap * 2 : 64);
+  int idx = t->len++;
+  t->hlin[idx] = HLS_NORMAL;
+  t->hlend[idx] = HLS_UNKNOWN;
+  t->gen[idx] = 0;
+
+  int off;
+  int k = tbFind(tb, &tb->hint, at, &off);
+  if (off > 0) {
+    // split piece k in two around the new row
+    tbOpenPieces(tb, k + 1, 1);
+    tb->pieces[k + 1] = tb->pieces[k];
+    tb->pieces[k + 1].start += off;
+    tb->pieces[k + 1].len -= off;
+    tb->pieces[k].len = off;
+    k++;
+  }
+
+  // typing consecutive lines keeps extending the same piece
+  piece *prev = k > 0 ? &tb->pieces[k - 1] : NULL;
+  if (prev && prev->src == src && prev->start + prev->len == idx) {
+    prev->len++;
+  } else {
+    tbOpenPieces(tb, k, 1);
+    tb->pieces[k].src = src;
+    tb->pieces[k].start = idx;
+    tb->pieces[k].len = 1;
+  }
+  tb->hint.piece = 0;
+  tb->hint.row = 0;
+  return tbNewRow(tb, src, idx);
+}
+
+// unlink document row at, its storage is left in place for the caller to free
+void tbDelete(struct textBuffer *tb, int at) {
+  int off;
+  int k = tbFind(tb, &tb->hint, at, &off);
+  if (k == tb->npieces)
     return;
 
-  memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
-  E.numrows--;
-  E.dirty++;
+  piece *p = &tb->pieces[k];
+  if (off == 0) {
+    p->start++;
+    p->len--;
+  } else if (off == p->len - 1) {
+    p->len--;
+  } else {
+    tbOpenPieces(tb, k + 1, 1);
+    p = &tb->pieces[k];
+    tb->pieces[k + 1] = *p;
+    tb->pieces[k + 1].start += off + 1;
+    tb->pieces[k + 1].len -= off + 1;
+    p->len = off;
+  }
+
+  if (p->len == 0) {
+    memmove(&tb->pieces[k], &tb->pieces[k + 1],
+            sizeof(piece) * (tb->npieces - k - 1));
+    tb->npieces--;
+  }
+  tb->hint.piece = 0;
+  tb->hint.row = 0;
+}
+
+/*** row arena ***/
+
+// usable bytes of a block of class cls
+size_t arenaClassSize(int cls) {
+  return ((size_t)1 << cls) - sizeof(struct arenaBlock);
+}
+
+// cut [p, end) into blocks for the free lists, largest first
+void arenaCarve(struct rowArena *a, char *p, char *end) {
+  int cls;
+  for (cls = ARENA_MAX_SHIFT; cls >= ARENA_MIN_SHIFT; cls--) {
+    while (end - p >= (1L << cls)) {
+      struct arenaBlock *b = (struct arenaBlock *)p;
+      b->u.next = a->free[cls];
+      a->free[cls] = b;
+      p += (size_t)1 << cls;
+    }
+  }
+}
+
+struct arenaLarge *arenaLargeOf(struct arenaBlock *b) {
+  return (struct arenaLarge *)((char *)b - offsetof(struct arenaLarge, head));
+}
+
+void *arenaAlloc(struct rowArena *a, size_t n) {
+  a->allocs++;
+  int cls = ARENA_MIN_SHIFT;
+  while (cls <= ARENA_MAX_SHIFT && arenaClassSize(cls) < n)
+    cls++;
+
+  if (cls > ARENA_MAX_SHIFT) {
+    struct arenaLarge *l = malloc(sizeof(struct arenaLarge) + n);
+    l->prev = NULL;
+    l->next = a->large;
+    if (a->large)
+      a->large->prev = l;
+    a->large = l;
+    l->size = n;
+    l->head.u.cls = ARENA_LARGE;
+    a->largebytes += n;
+    a->live += n;
+    return &l->head + 1;
+  }
+
+  struct arenaBlock *b = a->free[cls];
+  if (b) {
+    a->free[cls] = b->u.next;
+    a->reused++;
+  } else {
+    size_t size = (size_t)1 << cls;
+    if (a->bumpend - a->bump < (long)size) {
+      // the rest of the old slab still serves smaller blocks
+      arenaCarve(a, a->bump, a->bumpend);
+      if (a->nslabs == a->slabcap) {
+        a->slabcap = a->slabcap ? a->slabcap * 2 : 16;
+        a->slabs = realloc(a->slabs, sizeof(char *) * a->slabcap);
+      }
+      a->bump = a->slabs[a->nslabs++] = malloc(ARENA_SLAB);
+      a->bumpend = a->bump + ARENA_SLAB;
+    }
+    b = (struct arenaBlock *)a->bump;
+    a->bump += size;
+  }
+  b->u.cls = cls;
+  a->live += arenaClassSize(cls);
+  return b + 1;
+}
+
+size_t arenaCap(void *p) {
+  if (p == NULL)
+    return 0;
+  struct arenaBlock *b = (struct arenaBlock *)p - 1;
+  if (b->u.cls == ARENA_LARGE)
+    return arenaLargeOf(b)->size;
+  return arenaClassSize(b->u.cls);
+}
+
+void arenaFree(struct rowArena *a, void *p) {
+  if (p == NULL)
+    return;
+  struct arenaBlock *b = (struct arenaBlock *)p - 1;
+  a->live -= arenaCap(p);
+  if (b->u.cls == ARENA_LARGE) {
+    struct arenaLarge *l = arenaLargeOf(b);
+    if (l->prev)
+      l->prev->next = l->next;
+    else
+      a->large = l->next;
+    if (l->next)
+      l->next->prev = l->prev;
+    a->largebytes -= l->size;
+    free(l);
+    return;
+  }
+  int cls = b->u.cls;
+  b->u.next = a->free[cls];
+  a->free[cls] = b;
+}
+
+// like realloc. the block keeps its slack, so growing by a little stays
+// in place until the next power of two
+void *arenaRealloc(struct rowArena *a, void *p, size_t n) {
+  size_t cap = arenaCap(p);
+  if (p && n <= cap) {
+    a->grows++;
+    return p;
+  }
+  // big rows double too, appending to one is amortized O(1) either way
+  void *q = arenaAlloc(a, n > 2 * cap ? n : 2 * cap);
+  if (p) {
+    memcpy(q, p, cap);
+    arenaFree(a, p);
+    a->moves++;
+  }
+  return q;
+}
+
+// room for n bytes at p, what p held is not kept
+void *arenaReserve(struct rowArena *a, void *p, size_t n) {
+  if (p && n <= arenaCap(p))
+    return p;
+  arenaFree(a, p);
+  return arenaAlloc(a, n);
+}
+
+// give back everything, stats start over with the next buffer
+void arenaReset(struct rowArena *a) {
+  int j;
+  for (j = 0; j < a->nslabs; j++)
+    free(a->slabs[j]);
+  free(a->slabs);
+  while (a->large) {
+    struct arenaLarge *l = a->large;
+    a->large = l->next;
+    free(l);
+  }
+  memset(a, 0, sizeof(*a));
+}
+
+/*** row operations ***/
+
+// looked up in the tab stop table, every char after the last tab before cx
+// takes one column. the table is only built by editorUpdateRow, so a stale
+// row gets its render and hl rebuilt first. every caller is about to draw
+// the row or paint its hl anyway
+int editorRowCxToRx(erow *row, int cx) {
+  editorRowRender(row);
+  int lo = 0, hi = row->ntabs;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (row->tabs[mid * 2] < cx)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == 0)
+    return cx;
+  int *tab = &row->tabs[(lo - 1) * 2];
+  return tab[1] + (cx - tab[0] - 1);
+}
+
+// fill in render array from char
+// substitute for how tabs and control chars should be rendered
+void editorUpdateRow(erow *row) {
+  int tabs = 0;
+  int j;
+  for (j = 0; j < row->size; j++) {
+    if (row->chars[j] == '\t')
+      tabs++;
+  }
+
+  struct rowArena *a = &E.tb.arena;
+  row->render =
+      arenaReserve(a, row->render, row->size + tabs * (KILO_TAB_STOP - 1) + 1);
+  row->tabs = arenaReserve(a, row->tabs, sizeof(int) * 2 * tabs);
+  row->ntabs = 0;
+
+  int idx = 0;
+  for (j = 0; j < row->size; j++) {
+    if (row->chars[j] == '\t') {
+      row->render[idx++] = ' ';
+      while (idx % KILO_TAB_STOP != 0)
+        row->render[idx++] = ' ';
+      row->tabs[row->ntabs * 2] = j;
+      row->tabs[row->ntabs * 2 + 1] = idx;
+      row->ntabs++;
+    } else {
+      row->render[idx++] = row->chars[j];
+    }
+  }
+  row->render[idx] = '\0';
+  row->rsize = idx;
+
+  editorUpdateSyntax(row);
+  row->dirty = 0;
+}
+
+// called after chars change, render and hl are only rebuilt once the row
+// is drawn or searched so loading and editing never pay for rows off screen
+void editorInvalidateRow(erow *row) {
+  struct rowTable *t = tbTable(&E.tb, row->src);
+  row->dirty = 1;
+  row->matchgen = 0;
+  t->hlend[row->idx] = HLS_UNKNOWN;
+  t->gen[row->idx]++;
+}
+
+erow *editorRowRender(erow *row) {
+  if (row->dirty)
+    editorUpdateRow(row);
+  return row;
+}
+
+// fill a fresh row with given string and size
+// sizeof(row->chars) will be row->size + 1
+// since we append null at the end of it
+void editorInitRow(erow *row, char *s, size_t len) {
+  row->size = len;
+  // rows read from a file stay in the map, only new ones get a block
+  row->chars = arenaAlloc(&E.tb.arena, len + 1);
+  memcpy(row->chars, s, len);
+  row->chars[len] = '\0';
+
+  // init render vals
+  row->rsize = 0;
+  row->render = NULL;
+  row->hl = NULL;
+  row->tabs = NULL;
+  row->ntabs = 0;
+  editorInvalidateRow(row);
+}
+
+// insert row with given string and size
+void editorInsertRow(int at, char *s, size_t len) {
+  if (at < 0 || at > E.numrows)
+    return;
+
+  erow *row = tbInsert(&E.tb, at, PIECE_ADD);
+  editorInitRow(row, s, len);
+  trigramAddText(row, 0, len);
+  editorSyntaxStale(at);
+  E.layoutgen++;
+
+  E.numrows++;
+  E.dirty++;
+}
+
+void editorFreeRow(erow *row) {
+  struct rowArena *a = &E.tb.arena;
+  struct rowTable *t = tbTable(&E.tb, row->src);
+  t->gen[row->idx]++;
+  t->rows[row->idx] = NULL;
+  arenaFree(a, row->render);
+  arenaFree(a, row->matches);
+  arenaFree(a, row->tabs);
+  if (!tbMapped(&E.tb, row))
+    arenaFree(a, row->chars);
+  arenaFree(a, row->hl);
+  arenaFree(a, row);
+}
+
+// give a row its own copy of chars before it is edited
+void editorRowMakeWritable(erow *row) {
+  if (!tbMapped(&E.tb, row))
+    return;
+  char *chars = arenaAlloc(&E.tb.arena, row->size + 1);
+  memcpy(chars, row->chars, row->size);
+  chars[row->size] = '\0';
+  row->chars = chars;
+  tbOwn(&E.tb, row);
+}
+
+// swap the mapping for a copy of the file text, needed before the file is
+// rewritten under us. rows never edited keep reading it through lineoff
+void editorUnmapRows() {
+  if (!E.tb.mapfile)
+    return;
+  char *text = malloc(E.tb.maplen);
+  memcpy(text, E.tb.map, E.tb.maplen);
+  int j;
+  for (j = 0; j < E.tb.orig.len; j++) {
+    erow *row = E.tb.orig.rows[j];
+    if (row && tbMapped(&E.tb, row))
+      row->chars = text + (row->chars - E.tb.map);
+  }
+  munmap(E.tb.map, E.tb.maplen);
+  E.tb.map = text;
+  E.tb.mapfile = 0;
+}
+
+void editorDelRow(int at) {
+  if (at < 0 || at >= E.numrows)
+    return;
+
+  // the trigram index needs no update, it only reaches rows through the
+  // pieces and an unlinked row is in none of them
+  int idx;
+  struct rowTable *t = tbTable(&E.tb, tbLocate(&E.tb, &E.tb.hint, at, &idx));
+  if (t->rows[idx])
+    editorFreeRow(t->rows[idx]);
+  else
+    t->gen[idx]++;
+  tbDelete(&E.tb, at);
+  editorSyntaxStale(at);
+  E.layoutgen++;
+  E.numrows--;
+  E.dirty++;
+}
+
+// insert character c at row[at]
+void editorRowInsertChar(erow *row, int at, int c) {
+  // if index invalid set to end of line
+  if (at < 0 || at > row->size)
+    at = row->size;
+  editorRowMakeWritable(row);
+  // 1 for char and 1 because size doesn't include null at end of row->chars
+  // usually fits in the slack of the block
+  row->chars = arenaRealloc(&E.tb.arena, row->chars, row->size + 2);
+  memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+  row->size++;
+  row->chars[at] = c;
+  trigramAddText(row, at - 2, at + 1);
+  editorInvalidateRow(row);
+  E.dirty++;
+}
+
+void editorRowAppendString(erow *row, char *s, size_t len) {
+  // len won't include NULL neither does row size
+  // but row->chars has it so add + 1
+  editorRowMakeWritable(row);
+  row->chars = arenaRealloc(&E.tb.arena, row->chars, row->size + len + 1);
+  memcpy(&row->chars[row->size], s, len);
+  row->size += len;
+  row->chars[row->size] = '\0';
+  trigramAddText(row, row->size - len - 2, row->size);
+  editorInvalidateRow(row);
+  E.dirty++;
+}
+
+// how would backspace behave on an empty row?
+void editorRowDelChar(erow *row, int at) {
+  if (at < 0 || at >= row->size)
+    return;
+  editorRowMakeWritable(row);
+  // we copy the '\0' as well
+  memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
+  row->size--;
+  // the chars either side of the gap are now neighbours
+  trigramAddText(row, at - 2, at);
+  editorInvalidateRow(row);
+  E.dirty++;
+}
+
+// holds operations that will be called from editorProcessKeypress
+/*** editor operations ***/
+
+void editorInsertChar(int c) {
+  // insert row if on last line
+  if (E.cy == E.numrows) {
+    editorInsertRow(E.numrows, "", 0);
+  }
+  editorRowInsertChar(tbRow(&E.tb, E.cy), E.cx, c);
+  editorSyntaxStale(E.cy);
+  E.cx++;
+}
+
+void editorInsertNewline() {
+  if (E.cx == 0) {
+    editorInsertRow(E.cy, "", 0);
+  } else {
+    // move the rest of the line to new line
+    erow *row = tbRow(&E.tb, E.cy);
+    editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
+    row = tbRow(&E.tb, E.cy);
+    editorRowMakeWritable(row);
+    row->size = E.cx;
+    row->chars[row->size] = '\0';
+    editorInvalidateRow(row);
+    editorSyntaxStale(E.cy);
+  }
+  E.cy++;
+  E.cx = 0;
+}
+
+void editorDelChar() {
+  // passed end of file
+  if (E.cy == E.numrows)
+    return;
+  // start of file
+  if (E.cx == 0 && E.cy == 0)
+    return;
+
+  erow *row = tbRow(&E.tb, E.cy);
+  if (E.cx > 0) {
+    editorRowDelChar(row, E.cx - 1);
+    editorSyntaxStale(E.cy);
+    E.cx--;
+  } else {
+    // cursor will be placed at current end of line above
+    erow *prev = tbRow(&E.tb, E.cy - 1);
+    E.cx = prev->size;
+    editorRowAppendString(prev, row->chars, row->size);
+    editorDelRow(E.cy);
+    editorSyntaxStale(E.cy - 1);
+    E.cy--;
+  }
+}
+
+// rows are addressed directly, so jumping costs the same anywhere in the file
+void editorGotoLine(int line) {
+  if (line > E.numrows)
+    line = E.numrows;
+  E.cy = line > 0 ? line - 1 : 0;
+  E.cx = 0;
+}
+
+// run a line typed at the ':' prompt
+void editorCommand(char *cmd) {
+  if (cmd[0] != '\0' && strspn(cmd, "0123456789") == strlen(cmd)) {
+    editorGotoLine(atoi(cmd));
+    return;
+  }
+  if (strcmp(cmd, "hlsearch") == 0) {
+    E.hlsearch = !E.hlsearch;
+    if (!E.hlsearch)
+      editorSetHighlight(NULL);
+    editorSetStatusMessage("hlsearch %s", E.hlsearch ? "on" : "off");
+    return;
+  }
+  if (strcmp(cmd, "regex") == 0) {
+    E.regex = !E.regex;
+    // a query being painted means something else now
+    if (E.hlquery) {
+      char *query = strdup(E.hlquery);
+      editorSetHighlight(NULL);
+      editorSetHighlight(query);
+      free(query);
+    }
+    editorSetStatusMessage("regex %s", E.regex ? "on" : "off");
+    return;
+  }
+  if ((cmd[0] == 's' || strncmp(cmd, "%s", 2) == 0) &&
+      !isalnum((unsigned char)cmd[cmd[0] == '%' ? 2 : 1])) {
+    editorReplace(cmd);
+    return;
+  }
+  if (strcmp(cmd, "noh") == 0) {
+    editorSetHighlight(NULL);
+    return;
+  }
+  editorSetStatusMessage("Not an editor command: %s", cmd);
+}
+
+/*** line index ***/
+
+// offsets are pushed one per '\n' found, growing geometrically
+void editorPushLine(uint64_t **off, int *n, int *cap, uint64_t at) {
+  if (*n == *cap) {
+    *cap *= 2;
+    *off = realloc(*off, sizeof(uint64_t) * *cap);
+  }
+  (*off)[(*n)++] = at;
+}
+
+// vector scanners start at i and return how far they got, the scalar loop
+// finishes the tail. any '\r' seen sets *hascr so row ends are only
+// trimmed in files that have them
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) size_t
+editorScanLinesAvx2(const char *buf, size_t len, size_t i, uint64_t **off,
+                    int *n, int *cap, int *hascr) {
+  __m256i nl = _mm256_set1_epi8('\n');
+  __m256i cr = _mm256_set1_epi8('\r');
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+    unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+    if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, cr)))
+      *hascr = 1;
+    while (mask) {
+      editorPushLine(off, n, cap, i + __builtin_ctz(mask) + 1);
+      mask &= mask - 1;
+    }
+  }
+  return i;
+}
+#endif
+
+#ifdef __SSE2__
+size_t editorScanLinesSse2(const char *buf, size_t len, size_t i,
+                           uint64_t **off, int *n, int *cap, int *hascr) {
+  __m128i nl = _mm_set1_epi8('\n');
+  __m128i cr = _mm_set1_epi8('\r');
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+    unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, cr)))
+      *hascr = 1;
+    while (mask) {
+      editorPushLine(off, n, cap, i + __builtin_ctz(mask) + 1);
+      mask &= mask - 1;
+    }
+  }
+  return i;
+}
+#endif
+
+// build the line index of buf in one pass
+// line i spans off[i] .. off[i + 1] including its line ending, so the
+// returned array holds one more entry than there are lines
+uint64_t *editorIndexLines(const char *buf, size_t len, int *nlines,
+                           int *hascr) {
+  int n = 0;
+  int cap = len / 64 + 16;
+  uint64_t *off = malloc(sizeof(uint64_t) * cap);
+  size_t i = 0;
+
+  *hascr = 0;
+  editorPushLine(&off, &n, &cap, 0);
+#if defined(__x86_64__) || defined(__i386__)
+  if (__builtin_cpu_supports("avx2"))
+    i = editorScanLinesAvx2(buf, len, i, &off, &n, &cap, hascr);
+#endif
+#ifdef __SSE2__
+  i = editorScanLinesSse2(buf, len, i, &off, &n, &cap, hascr);
+#endif
+  for (; i < len; i++) {
+    if (buf[i] == '\n')
+      editorPushLine(&off, &n, &cap, i + 1);
+    else if (buf[i] == '\r')
+      *hascr = 1;
+  }
+
+  // last line without a trailing newline
+  if (off[n - 1] != len)
+    editorPushLine(&off, &n, &cap, len);
+  *nlines = n - 1;
+  return off;
+}
+
+/*** file i/o ***/
+
+// bytes of the unedited rows at..at+n-1 once saved, *from and *to are
+// their text in map. only the last line of the file may lack its '\n'.
+// c is the caller's cursor, a walk over the rows moves it along
+size_t editorSpanLen(struct tbCursor *c, int at, int *n, size_t *from,
+                     size_t *to) {
+  // rows ending in "\r\n" are written back with '\n' alone
+  *n = E.tb.hascr ? 0 : tbSpan(&E.tb, c, at, E.numrows - at, from, to);
+  if (*n == 0)
+    return 0;
+  return *to - *from + (E.tb.map[*to - 1] != '\n');
+}
+
+// runs of unedited rows are copied from the file text in one go
+char *editorRowsToString(int *buflen) {
+  struct tbCursor c = {0, 0};
+  size_t from, to;
+  size_t totlen = 0;
+  int j, n, size;
+  for (j = 0; j < E.numrows; j += n ? n : 1) {
+    size_t len = editorSpanLen(&c, j, &n, &from, &to);
+    if (n == 0) {
+      tbText(&E.tb, &c, j, &size);
+      len = size + 1;
+    }
+    totlen += len;
+  }
+  *buflen = totlen;
+
+  char *buf = malloc(totlen);
+  char *p = buf;
+  c.piece = 0;
+  c.row = 0;
+  for (j = 0; j < E.numrows; j += n ? n : 1) {
+    size_t len = editorSpanLen(&c, j, &n, &from, &to);
+    if (n) {
+      memcpy(p, E.tb.map + from, to - from);
+      p += len;
+      p[-1] = '\n';
+      continue;
+    }
+    const char *text = tbText(&E.tb, &c, j, &size);
+    memcpy(p, text, size);
+    p += size;
+    *p = '\n';
+    p++;
+  }
+  return buf;
+}
+
+// the line index is all opening a file builds, one piece covers its rows
+// and their text stays in map. an erow is only made for a row once it is
+// edited or drawn
+void editorLoadText(char *text, size_t len, int mapfile) {
+  E.tb.map = text;
+  E.tb.maplen = len;
+  E.tb.mapfile = mapfile;
+  E.layoutgen++;
+
+  int n;
+  E.tb.lineoff = editorIndexLines(text, len, &n, &E.tb.hascr);
+  E.tb.nlines = n;
+  E.tb.origown = calloc(n / 64 + 1, sizeof(uint64_t));
+
+  struct rowTable *t = &E.tb.orig;
+  tbGrow(t, n ? n : 1);
+  memset(t->rows, 0, sizeof(erow *) * n);
+  memset(t->hlin, HLS_NORMAL, n);
+  memset(t->hlend, HLS_UNKNOWN, n);
+  memset(t->gen, 0, sizeof(unsigned int) * n);
+  t->len = n;
+  if (n) {
+    tbOpenPieces(&E.tb, 0, 1);
+    E.tb.pieces[0].src = PIECE_ORIG;
+    E.tb.pieces[0].start = 0;
+    E.tb.pieces[0].len = n;
+  }
+  E.numrows = n;
+
+  if (len >= TRIGRAM_MIN_BYTES)
+    trigramStart();
+}
+
+void editorOpen(char *filename) {
+  free(E.filename);
+  E.filename = strdup(filename);
+
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1)
+    die("open");
+
+  // regular files are mapped, anything else (pipes, empty files)
+  // is read into memory first
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      close(fd);
+      editorLoadText(map, st.st_size, 1);
+      editorSelectSyntaxHighlight();
+      return;
+    }
+  }
+
+  size_t cap = 4096;
+  size_t len = 0;
+  char *text = malloc(cap);
+  ssize_t nread;
+  while ((nread = read(fd, &text[len], cap - len)) > 0) {
+    len += nread;
+    if (len == cap) {
+      cap *= 2;
+      text = realloc(text, cap);
+    }
+  }
+  if (nread == -1)
+    die("read");
+  close(fd);
+  editorLoadText(text, len, 0);
+  editorSelectSyntaxHighlight();
+}
+
+// drop the current buffer and everything it holds
+void editorCloseFile() {
+  trigramFree();
+  // everything the rows own is in the arena
+  arenaReset(&E.tb.arena);
+  tbFreeTable(&E.tb.orig);
+  tbFreeTable(&E.tb.add);
+  free(E.tb.pieces);
+  free(E.tb.lineoff);
+  free(E.tb.origown);
+  if (E.tb.mapfile)
+    munmap(E.tb.map, E.tb.maplen);
+  else
+    free(E.tb.map);
+  memset(&E.tb, 0, sizeof(E.tb));
+
+  free(E.filename);
+  E.filename = NULL;
+  E.numrows = 0;
+  E.cx = E.cy = E.rx = 0;
+  E.rowoff = E.coloff = 0;
+  E.dirty = 0;
+  E.syntax = NULL;
+  E.hlvalid = 0;
+  E.layoutgen++;
+}
+
+void editorSave() {
+  if (E.filename == NULL) {
+    E.filename = editorPrompt("Save as: %s", NULL);
+    if (E.filename == NULL) {
+      editorSetStatusMessage("Save aborted");
+      return;
+    }
+  }
+
+  int len;
+  char *buf = editorRowsToString(&len);
+  // truncating a mapped file would pull the rows out from under us, and
+  // the index builder reads them too. it carries on from the copy
+  trigramStop();
+  editorUnmapRows();
+  trigramResume();
+  int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
+  if (fd != -1) {
+    if (ftruncate(fd, len) != -1) {
+      if (write(fd, buf, len) != -1) {
+        close(fd);
+        free(buf);
+        E.dirty = 0;
+        editorSetStatusMessage("%d bytes written to disk", len);
+        return;
+      }
+    }
+    close(fd);
+  }
+  free(buf);
+  editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+}
+
+/*** workers ***/
+
+// take and run tasks of the current batch until none are left
+void workerDrain(struct workerPool *p) {
+  pthread_mutex_lock(&p->lock);
+  while (p->next < p->ntasks) {
+    int task = p->next++;
+    pthread_mutex_unlock(&p->lock);
+    p->fn(p->arg, task);
+    pthread_mutex_lock(&p->lock);
+    if (--p->pending == 0)
+      pthread_cond_signal(&p->done);
+  }
+  pthread_mutex_unlock(&p->lock);
+}
+
+void *workerMain(void *arg) {
+  struct workerPool *p = arg;
+  while (1) {
+    pthread_mutex_lock(&p->lock);
+    while (p->next >= p->ntasks)
+      pthread_cond_wait(&p->work, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+    workerDrain(p);
+  }
+  return NULL;
+}
+
+void workerStart(struct workerPool *p) {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  pthread_mutex_init(&p->lock, NULL);
+  pthread_cond_init(&p->work, NULL);
+  pthread_cond_init(&p->done, NULL);
+  p->nthreads = cores > 1 ? cores - 1 : 0;
+  p->threads = malloc(sizeof(pthread_t) * (p->nthreads ? p->nthreads : 1));
+  int j;
+  for (j = 0; j < p->nthreads; j++)
+    pthread_create(&p->threads[j], NULL, workerMain, p);
+}
+
+// run fn(arg, 0..ntasks-1) on the pool and the calling thread, then wait
+// for all of them. tasks must not touch shared state without locking
+void editorParallel(void (*fn)(void *, int), void *arg, int ntasks) {
+  struct workerPool *p = &E.pool;
+  if (!p->threads)
+    workerStart(p);
+
+  pthread_mutex_lock(&p->lock);
+  p->fn = fn;
+  p->arg = arg;
+  p->next = 0;
+  p->ntasks = ntasks;
+  p->pending = ntasks;
+  pthread_cond_broadcast(&p->work);
+  pthread_mutex_unlock(&p->lock);
+
+  workerDrain(p);
+
+  pthread_mutex_lock(&p->lock);
+  while (p->pending)
+    pthread_cond_wait(&p->done, &p->lock);
+  pthread_mutex_unlock(&p->lock);
+}
+
+/*** background highlighting ***/
+
+// copy rows from E.hlvalid on, lock held. states come from the arrays
+// and text from tbRowText, so rows off screen never get an erow
+void hlSnapshot(struct hlBatch *b) {
+  struct tbCursor c = {0, 0};
+  int idx;
+  b->syntax = E.syntax;
+  b->layoutgen = E.layoutgen;
+  b->first = E.hlvalid;
+  b->state = HLS_NORMAL;
+  if (b->first > 0) {
+    int src = tbLocate(&E.tb, &c, b->first - 1, &idx);
+    b->state = tbTable(&E.tb, src)->hlend[idx];
+  }
+  b->nrows = 0;
+  b->textlen = 0;
+  int at;
+  for (at = b->first; at < E.numrows && b->nrows < HL_BATCH_ROWS &&
+                      b->textlen < HL_BATCH_BYTES;
+       at++) {
+    int src = tbLocate(&E.tb, &c, at, &idx);
+    struct rowTable *t = tbTable(&E.tb, src);
+    int size;
+    const char *text = tbRowText(&E.tb, src, idx, &size);
+    if (b->nrows == b->rowcap) {
+      b->rowcap = b->rowcap ? b->rowcap * 2 : 256;
+      b->rows = realloc(b->rows, sizeof(struct hlBatchRow) * b->rowcap);
+    }
+    if (!b->text || b->textlen + size > b->textcap) {
+      b->textcap = b->textlen + size + HL_BATCH_BYTES;
+      b->text = realloc(b->text, b->textcap);
+    }
+    struct hlBatchRow *r = &b->rows[b->nrows++];
+    r->src = src;
+    r->idx = idx;
+    r->gen = t->gen[idx];
+    r->off = b->textlen;
+    r->size = size;
+    r->hlin = t->hlin[idx];
+    r->hlend = t->hlend[idx];
+    memcpy(&b->text[b->textlen], text, size);
+    b->textlen += size;
+  }
+}
+
+// the same walk as editorSyntaxSync over the copy, lock released
+void hlLexBatch(struct hlBatch *b) {
+  int state = b->state;
+  int k;
+  for (k = 0; k < b->nrows; k++) {
+    struct hlBatchRow *r = &b->rows[k];
+    if (r->hlend == HLS_UNKNOWN || r->hlin != state)
+      r->hlend = editorSyntaxLex(b->syntax, &b->text[r->off], r->size,
+                                 state, NULL);
+    r->hlin = state;
+    state = r->hlend;
+  }
+}
+
+// store the states of rows nobody edited meanwhile, lock held
+// rows inserted or deleted, or the frontier moved, throw the whole batch
+// away. otherwise the first row whose generation moved ends it, the rows
+// after it start in a state that is no longer known
+void hlCommit(struct hlBatch *b) {
+  if (b->layoutgen != E.layoutgen || b->first != E.hlvalid ||
+      b->syntax != E.syntax)
+    return;
+  int k;
+  for (k = 0; k < b->nrows; k++) {
+    struct hlBatchRow *r = &b->rows[k];
+    struct rowTable *t = tbTable(&E.tb, r->src);
+    if (t->gen[r->idx] != r->gen)
+      break;
+    if (t->hlin[r->idx] != r->hlin && t->rows[r->idx])
+      t->rows[r->idx]->dirty = 1;
+    t->hlin[r->idx] = r->hlin;
+    t->hlend[r->idx] = r->hlend;
+  }
+  E.hlvalid = b->first + k;
+  if (k && b->first < E.rowoff + E.screenrows && E.hlvalid > E.rowoff)
+    E.hlw.redraw = 1;
+}
+
+void *hlWorkerMain(void *arg) {
+  struct hlWorker *w = arg;
+  struct hlBatch b;
+  memset(&b, 0, sizeof(b));
+  pthread_mutex_lock(&w->lock);
+  while (!w->stop) {
+    if (E.hlvalid >= E.numrows || !E.syntax) {
+      pthread_cond_wait(&w->wake, &w->lock);
+      continue;
+    }
+    hlSnapshot(&b);
+    pthread_mutex_unlock(&w->lock);
+    hlLexBatch(&b);
+    pthread_mutex_lock(&w->lock);
+    hlCommit(&b);
+  }
+  pthread_mutex_unlock(&w->lock);
+  free(b.rows);
+  free(b.text);
+  return NULL;
+}
+
+// start the worker, the calling thread owns the lock from here on
+void hlWorkerStart() {
+  struct hlWorker *w = &E.hlw;
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->wake, NULL);
+  w->stop = 0;
+  w->redraw = 0;
+  pthread_mutex_lock(&w->lock);
+  w->running = 1;
+  pthread_create(&w->thread, NULL, hlWorkerMain, w);
+}
+
+void hlWorkerWake() {
+  if (E.hlw.running)
+    pthread_cond_signal(&E.hlw.wake);
+}
+
+void hlWorkerStop() {
+  struct hlWorker *w = &E.hlw;
+  if (!w->running)
+    return;
+  w->stop = 1;
+  pthread_cond_signal(&w->wake);
+  pthread_mutex_unlock(&w->lock);
+  pthread_join(w->thread, NULL);
+  pthread_mutex_destroy(&w->lock);
+  pthread_cond_destroy(&w->wake);
+  w->running = 0;
+}
+
+/*** trigram index ***/
+
+// 13 bits from the top of the product, one per bit of TRIGRAM_BITS
+uint32_t trigramHash(const char *p) {
+  const unsigned char *u = (const unsigned char *)p;
+  uint32_t t = (uint32_t)u[0] << 16 | (uint32_t)u[1] << 8 | u[2];
+  return (t * 2654435761u) >> 19;
+}
+
+void trigramSetText(uint64_t *bits, const char *text, size_t len) {
+  size_t i;
+  for (i = 0; i + 3 <= len; i++) {
+    uint32_t h = trigramHash(&text[i]);
+    bits[h >> 6] |= 1ULL << (h & 63);
+  }
+}
+
+// bitmap of the block row belongs to, add blocks are created on demand
+uint64_t *trigramBlock(erow *row) {
+  struct trigramIndex *ix = &E.trigrams;
+  int b = row->idx / TRIGRAM_BLOCK_ROWS;
+  if (row->src == PIECE_ORIG)
+    return &ix->orig[(size_t)b * TRIGRAM_WORDS];
+  if (b >= ix->nadd) {
+    ix->add = realloc(ix->add, sizeof(uint64_t) * TRIGRAM_WORDS * (b + 1));
+    memset(&ix->add[(size_t)ix->nadd * TRIGRAM_WORDS], 0,
+           sizeof(uint64_t) * TRIGRAM_WORDS * (b + 1 - ix->nadd));
+    ix->nadd = b + 1;
+  }
+  return &ix->add[(size_t)b * TRIGRAM_WORDS];
+}
+
+// index the trigrams of row starting in [from, to), called after edits
+void trigramAddText(erow *row, int from, int to) {
+  struct trigramIndex *ix = &E.trigrams;
+  if (!ix->orig)
+    return;
+  if (from < 0)
+    from = 0;
+  if (to > row->size - 2)
+    to = row->size - 2;
+  if (from >= to)
+    return;
+  pthread_mutex_lock(&ix->lock);
+  trigramSetText(trigramBlock(row), &row->chars[from], to - from + 2);
+  pthread_mutex_unlock(&ix->lock);
+}
+
+// fills the orig blocks from the file text, which stays put until the
+// buffer is saved or closed and both stop the builder first. it starts at
+// the first block not built yet, so a stopped builder can be resumed
+void *trigramBuild(void *arg) {
+  struct trigramIndex *ix = arg;
+  uint64_t bits[TRIGRAM_WORDS];
+  int b, j;
+  for (b = ix->built; b < ix->norig; b++) {
+    int first = b * TRIGRAM_BLOCK_ROWS;
+    int last = first + TRIGRAM_BLOCK_ROWS < E.tb.nlines
+                   ? first + TRIGRAM_BLOCK_ROWS
+                   : E.tb.nlines;
+    // a block is one run of the file, trigrams across its line breaks
+    // get in too and only cost a little precision
+    memset(bits, 0, sizeof(bits));
+    trigramSetText(bits, E.tb.map + E.tb.lineoff[first],
+                   E.tb.lineoff[last] - E.tb.lineoff[first]);
+
+    // edits may have set bits in this block already
+    pthread_mutex_lock(&ix->lock);
+    int stop = ix->stop;
+    if (!stop) {
+      for (j = 0; j < TRIGRAM_WORDS; j++)
+        ix->orig[(size_t)b * TRIGRAM_WORDS + j] |= bits[j];
+      ix->built++;
+    }
+    pthread_mutex_unlock(&ix->lock);
+    if (stop)
+      break;
+  }
+  return NULL;
+}
+
+// index the buffer just opened in the background, searches scan every
+// row as before until the builder is done
+void trigramStart() {
+  struct trigramIndex *ix = &E.trigrams;
+  if (ix->orig || !E.tb.map || E.tb.orig.len == 0 || E.dirty)
+    return;
+  ix->norig = (E.tb.orig.len + TRIGRAM_BLOCK_ROWS - 1) / TRIGRAM_BLOCK_ROWS;
+  ix->orig = calloc((size_t)ix->norig * TRIGRAM_WORDS, sizeof(uint64_t));
+  ix->built = 0;
+  ix->stop = 0;
+  pthread_mutex_init(&ix->lock, NULL);
+  ix->running = 1;
+  pthread_create(&ix->thread, NULL, trigramBuild, ix);
+}
+
+// wait for the builder, the blocks it finished are kept
+void trigramStop() {
+  struct trigramIndex *ix = &E.trigrams;
+  if (!ix->running)
+    return;
+  pthread_mutex_lock(&ix->lock);
+  ix->stop = 1;
+  pthread_mutex_unlock(&ix->lock);
+  pthread_join(ix->thread, NULL);
+  ix->running = 0;
+}
+
+// pick up building where trigramStop left off
+void trigramResume() {
+  struct trigramIndex *ix = &E.trigrams;
+  if (ix->running || !ix->orig || ix->built == ix->norig)
+    return;
+  ix->stop = 0;
+  ix->running = 1;
+  pthread_create(&ix->thread, NULL, trigramBuild, ix);
+}
+
+void trigramFree() {
+  struct trigramIndex *ix = &E.trigrams;
+  trigramStop();
+  if (ix->orig)
+    pthread_mutex_destroy(&ix->lock);
+  free(ix->orig);
+  free(ix->add);
+  memset(ix, 0, sizeof(*ix));
+}
+
+int trigramReady() {
+  struct trigramIndex *ix = &E.trigrams;
+  if (!ix->orig)
+    return 0;
+  pthread_mutex_lock(&ix->lock);
+  int ready = ix->built == ix->norig;
+  pthread_mutex_unlock(&ix->lock);
+  return ready;
+}
+
+// rows that may contain query, in document order, or NULL if the index
+// can't tell and every row has to be scanned. blocks are mapped back to
+// rows through the pieces, so deleted rows never come back
+int *trigramCandidates(const char *query, int *nrows) {
+  struct trigramIndex *ix = &E.trigrams;
+  int len = strlen(query);
+  if (E.regex || len < 3 || !trigramReady())
+    return NULL;
+
+  uint32_t *hash = malloc(sizeof(uint32_t) * (len - 2));
+  int j;
+  for (j = 0; j < len - 2; j++)
+    hash[j] = trigramHash(&query[j]);
+
+  int *rows = malloc(sizeof(int) * 64);
+  int cap = 64;
+  int n = 0;
+  int doc = 0;
+  int k;
+  for (k = 0; k < E.tb.npieces; k++) {
+    piece *p = &E.tb.pieces[k];
+    uint64_t *blocks = p->src == PIECE_ORIG ? ix->orig : ix->add;
+    int nblocks = p->src == PIECE_ORIG ? ix->norig : ix->nadd;
+    int id = p->start;
+    while (id < p->start + p->len) {
+      int b = id / TRIGRAM_BLOCK_ROWS;
+      int end = (b + 1) * TRIGRAM_BLOCK_ROWS;
+      if (end > p->start + p->len)
+        end = p->start + p->len;
+
+      // add blocks past nadd only hold rows too short for a trigram
+      uint64_t *bits = b < nblocks ? &blocks[(size_t)b * TRIGRAM_WORDS] : NULL;
+      for (j = 0; bits && j < len - 2; j++)
+        if (!(bits[hash[j] >> 6] >> (hash[j] & 63) & 1))
+          bits = NULL;
+      if (bits) {
+        if (n + end - id > cap) {
+          cap = (n + end - id) * 2;
+          rows = realloc(rows, sizeof(int) * cap);
+        }
+        for (j = id; j < end; j++)
+          rows[n++] = doc + j - p->start;
+      }
+      id = end;
+    }
+    doc += p->len;
+  }
+  free(hash);
+  *nrows = n;
+  return rows;
+}
+
+/*** regex ***/
+
+// search patterns in :regex mode, a subset of egrep: . [] () | * + ? {m,n}
+// ^ $ and \d \w \s. a pattern is compiled to a thompson nfa which lazily
+// built dfas run over the row one table lookup per byte, so matching never
+// backtracks and no pattern can blow up on a long line
+#define RE_MAX_INST 4096
+#define RE_MAX_STATES 1024 // per dfa, the cache starts over once it is full
+#define RE_TABLE_SIZE (RE_MAX_STATES * 2)
+
+enum reOp { RE_SET, RE_SPLIT, RE_JMP, RE_BOL, RE_EOL, RE_MATCH };
+
+// RE_SET, RE_BOL and RE_EOL continue at the next instruction
+struct reInst {
+  int op;
+  int x, y;        // RE_SPLIT goes to both, RE_JMP to x
+  uint32_t set[8]; // bytes RE_SET accepts
+};
+
+struct reProg {
+  struct reInst *inst;
+  int ninst;
+  int cap;
+};
+
+enum reNodeType { RN_SET, RN_CAT, RN_ALT, RN_REP, RN_BOL, RN_EOL, RN_EMPTY };
+
+struct reNode {
+  int type;
+  int a, b;     // children
+  int min, max; // RN_REP bounds, max is -1 if there is none
+  uint32_t set[8];
+};
+
+struct reParser {
+  const char *p;
+  struct reNode *nodes;
+  int nnodes;
+  int cap;
+  int err;
+};
+
+// a dfa state is the set of nfa threads alive after reading some bytes
+struct reState {
+  int next[256]; // state after each byte, -1 until it is first needed
+  int *pcs;      // sorted threads, assertions that did not hold yet included
+  int npcs;      // 0 is the dead state
+  int match;     // a thread reached RE_MATCH
+  int edge;      // matches at the end of the scan, -1 until checked
+};
+
+struct reDfa {
+  struct reProg *prog;
+  int unanchored; // a new thread starts before every byte
+  int startop;    // assertion holding where a scan from the edge starts
+  int edgeop;     // assertion holding where the scan ends
+  struct reState *states;
+  int nstates;
+  int cap;
+  int table[RE_TABLE_SIZE]; // hash of pcs to state, -1 if empty
+  int start[2];             // start state off and on the starting edge
+  int flushes;
+  int *work; // scratch for the thread set being built
+  int *stack;
+  unsigned int *mark;
+  unsigned int gen;
+};
+
+// forward the program finds if a row matches, backward where the leftmost
+// match starts and anchored forward again how long it is
+struct regex {
+  struct reProg fwd;
+  struct reProg rev;
+  struct reDfa any;
+  struct reDfa first;
+  struct reDfa longest;
+};
+
+void reSetAdd(uint32_t *set, int from, int to) {
+  int c;
+  for (c = from; c <= to; c++)
+    set[c >> 5] |= 1u << (c & 31);
+}
+
+int reNewNode(struct reParser *p, int type, int a, int b) {
+  if (p->nnodes == p->cap) {
+    p->cap = p->cap ? p->cap * 2 : 32;
+    p->nodes = realloc(p->nodes, sizeof(struct reNode) * p->cap);
+  }
+  struct reNode *n = &p->nodes[p->nnodes];
+  memset(n, 0, sizeof(*n));
+  n->type = type;
+  n->a = a;
+  n->b = b;
+  return p->nnodes++;
+}
+
+// \d \w \s and their negations, 0 if c names no class
+int reClassEscape(uint32_t *set, char c) {
+  uint32_t cls[8] = {0};
+  int j;
+  switch (c | 0x20) {
+  case 'd':
+    reSetAdd(cls, '0', '9');
+    break;
+  case 'w':
+    reSetAdd(cls, '0', '9');
+    reSetAdd(cls, 'a', 'z');
+    reSetAdd(cls, 'A', 'Z');
+    reSetAdd(cls, '_', '_');
+    break;
+  case 's':
+    reSetAdd(cls, '\t', '\r');
+    reSetAdd(cls, ' ', ' ');
+    break;
+  default:
+    return 0;
+  }
+  for (j = 0; j < 8; j++)
+    set[j] |= c & 0x20 ? cls[j] : ~cls[j];
+  return 1;
+}
+
+char reEscapeChar(char c) { return c == 't' ? '\t' : c; }
+
+// [...] with ranges, the leading ^ negates
+int reParseClass(struct reParser *p) {
+  int n = reNewNode(p, RN_SET, 0, 0);
+  uint32_t set[8] = {0};
+  int negate = 0;
+  int j;
+  if (*p->p == '^') {
+    negate = 1;
+    p->p++;
+  }
+  int first = 1;
+  while (*p->p && (*p->p != ']' || first)) {
+    first = 0;
+    unsigned char lo = *p->p++;
+    if (lo == '\\' && *p->p) {
+      if (reClassEscape(set, *p->p)) {
+        p->p++;
+        continue;
+      }
+      lo = reEscapeChar(*p->p++);
+    }
+    unsigned char hi = lo;
+    if (p->p[0] == '-' && p->p[1] && p->p[1] != ']') {
+      hi = p->p[1];
+      p->p += 2;
+      if (hi == '\\' && *p->p)
+        hi = reEscapeChar(*p->p++);
+      if (hi < lo) {
+        p->err = 1;
+        return n;
+      }
+    }
+    reSetAdd(set, lo, hi);
+  }
+  if (*p->p != ']') {
+    p->err = 1;
+    return n;
+  }
+  p->p++;
+  for (j = 0; j < 8; j++)
+    p->nodes[n].set[j] = negate ? ~set[j] : set[j];
+  return n;
+}
+
+int reParseAlt(struct reParser *p);
+
+int reParseAtom(struct reParser *p) {
+  char c = *p->p++;
+  int n;
+  switch (c) {
+  case '(':
+    n = reParseAlt(p);
+    if (*p->p != ')')
+      p->err = 1;
+    else
+      p->p++;
+    return n;
+  case '[':
+    return reParseClass(p);
+  case '^':
+    return reNewNode(p, RN_BOL, 0, 0);
+  case '$':
+    return reNewNode(p, RN_EOL, 0, 0);
+  case '*':
+  case '+':
+  case '?':
+    // nothing to repeat
+    p->err = 1;
+    return reNewNode(p, RN_EMPTY, 0, 0);
+  }
+
+  n = reNewNode(p, RN_SET, 0, 0);
+  if (c == '.') {
+    reSetAdd(p->nodes[n].set, 0, 255);
+  } else if (c == '\\') {
+    if (*p->p == '\0') {
+      p->err = 1;
+      return n;
+    }
+    c = *p->p++;
+    if (!reClassEscape(p->nodes[n].set, c))
+      reSetAdd(p->nodes[n].set, (unsigned char)reEscapeChar(c),
+               (unsigned char)reEscapeChar(c));
+  } else {
+    reSetAdd(p->nodes[n].set, (unsigned char)c, (unsigned char)c);
+  }
+  return n;
+}
+
+// {m}, {m,} or {m,n} after an atom, anything else leaves { as a literal
+int reParseBounds(struct reParser *p, int *min, int *max) {
+  const char *s = p->p + 1;
+  if (!isdigit((unsigned char)*s))
+    return 0;
+  *min = strtol(s, (char **)&s, 10);
+  *max = *min;
+  if (*s == ',') {
+    s++;
+    *max = -1;
+    if (isdigit((unsigned char)*s))
+      *max = strtol(s, (char **)&s, 10);
+  }
+  if (*s != '}')
+    return 0;
+  if (*min > 255 || *max > 255 || (*max != -1 && *max < *min))
+    p->err = 1;
+  p->p = s + 1;
+  return 1;
+}
+
+int reParseRepeat(struct reParser *p) {
+  int n = reParseAtom(p);
+  while (!p->err) {
+    int min, max;
+    char c = *p->p;
+    if (c == '*' || c == '+' || c == '?') {
+      min = c == '+';
+      max = c == '?' ? 1 : -1;
+      p->p++;
+    } else if (c != '{' || !reParseBounds(p, &min, &max)) {
+      break;
+    }
+    n = reNewNode(p, RN_REP, n, 0);
+    p->nodes[n].min = min;
+    p->nodes[n].max = max;
+  }
+  return n;
+}
+
+int reParseCat(struct reParser *p) {
+  int n = -1;
+  while (!p->err && *p->p && *p->p != '|' && *p->p != ')') {
+    int m = reParseRepeat(p);
+    n = n == -1 ? m : reNewNode(p, RN_CAT, n, m);
+  }
+  return n == -1 ? reNewNode(p, RN_EMPTY, 0, 0) : n;
+}
+
+int reParseAlt(struct reParser *p) {
+  int n = reParseCat(p);
+  while (!p->err && *p->p == '|') {
+    p->p++;
+    n = reNewNode(p, RN_ALT, n, reParseCat(p));
+  }
+  return n;
+}
+
+int reEmitInst(struct reProg *g, int op) {
+  if (g->ninst == g->cap) {
+    g->cap = g->cap ? g->cap * 2 : 64;
+    g->inst = realloc(g->inst, sizeof(struct reInst) * g->cap);
+  }
+  struct reInst *in = &g->inst[g->ninst];
+  memset(in, 0, sizeof(*in));
+  in->op = op;
+  return g->ninst++;
+}
+
+// concatenations are emitted back to front for the reversed program
+// assertions keep their meaning, they are checked against the row either way
+void reEmitNode(struct reProg *g, struct reNode *nodes, int n, int rev) {
+  struct reNode *nd = &nodes[n];
+  int pc, jmp, j;
+  if (g->ninst >= RE_MAX_INST)
+    return;
+  switch (nd->type) {
+  case RN_SET:
+    pc = reEmitInst(g, RE_SET);
+    memcpy(g->inst[pc].set, nd->set, sizeof(nd->set));
+    break;
+  case RN_BOL:
+    reEmitInst(g, RE_BOL);
+    break;
+  case RN_EOL:
+    reEmitInst(g, RE_EOL);
+    break;
+  case RN_EMPTY:
+    break;
+  case RN_CAT:
+    reEmitNode(g, nodes, rev ? nd->b : nd->a, rev);
+    reEmitNode(g, nodes, rev ? nd->a : nd->b, rev);
+    break;
+  case RN_ALT:
+    pc = reEmitInst(g, RE_SPLIT);
+    g->inst[pc].x = pc + 1;
+    reEmitNode(g, nodes, nd->a, rev);
+    jmp = reEmitInst(g, RE_JMP);
+    g->inst[pc].y = g->ninst;
+    reEmitNode(g, nodes, nd->b, rev);
+    g->inst[jmp].x = g->ninst;
+    break;
+  case RN_REP:
+    for (j = 0; j < nd->min; j++)
+      reEmitNode(g, nodes, nd->a, rev);
+    if (nd->max == -1) {
+      pc = reEmitInst(g, RE_SPLIT);
+      g->inst[pc].x = pc + 1;
+      reEmitNode(g, nodes, nd->a, rev);
+      jmp = reEmitInst(g, RE_JMP);
+      g->inst[jmp].x = pc;
+      g->inst[pc].y = g->ninst;
+    } else if (nd->max > nd->min) {
+      // every optional copy can skip to the end
+      int *skips = malloc(sizeof(int) * (nd->max - nd->min));
+      for (j = 0; j < nd->max - nd->min; j++) {
+        skips[j] = reEmitInst(g, RE_SPLIT);
+        g->inst[skips[j]].x = skips[j] + 1;
+        reEmitNode(g, nodes, nd->a, rev);
+      }
+      for (j = 0; j < nd->max - nd->min; j++)
+        g->inst[skips[j]].y = g->ninst;
+      free(skips);
+    }
+    break;
+  }
+}
+
+void reDfaInit(struct reDfa *d, struct reProg *g, int unanchored, int rev) {
+  memset(d, 0, sizeof(*d));
+  d->prog = g;
+  d->unanchored = unanchored;
+  d->startop = rev ? RE_EOL : RE_BOL;
+  d->edgeop = rev ? RE_BOL : RE_EOL;
+  memset(d->table, -1, sizeof(d->table));
+  d->start[0] = d->start[1] = -1;
+  d->work = malloc(sizeof(int) * g->ninst);
+  d->stack = malloc(sizeof(int) * (g->ninst * 2 + 1));
+  d->mark = calloc(g->ninst, sizeof(unsigned int));
+}
+
+void reDfaFlush(struct reDfa *d) {
+  int j;
+  for (j = 0; j < d->nstates; j++)
+    free(d->states[j].pcs);
+  d->nstates = 0;
+  memset(d->table, -1, sizeof(d->table));
+  d->start[0] = d->start[1] = -1;
+  d->flushes++;
+}
+
+void reDfaFree(struct reDfa *d) {
+  reDfaFlush(d);
+  free(d->states);
+  free(d->work);
+  free(d->stack);
+  free(d->mark);
+}
+
+// add pc and every thread reachable from it without reading a byte to the
+// set in d->work. assertions in flags are followed, others stay in the set
+void reAddThread(struct reDfa *d, int pc, int flags, int *n) {
+  int sp = 0;
+  d->stack[sp++] = pc;
+  while (sp) {
+    pc = d->stack[--sp];
+    if (d->mark[pc] == d->gen)
+      continue;
+    d->mark[pc] = d->gen;
+    struct reInst *in = &d->prog->inst[pc];
+    if (in->op == RE_SPLIT) {
+      d->stack[sp++] = in->y;
+      d->stack[sp++] = in->x;
+    } else if (in->op == RE_JMP) {
+      d->stack[sp++] = in->x;
+    } else if ((in->op == RE_BOL || in->op == RE_EOL) &&
+               (flags & (1 << in->op))) {
+      d->stack[sp++] = pc + 1;
+    } else {
+      d->work[(*n)++] = pc;
+    }
+  }
+}
+
+int reCmpInt(const void *a, const void *b) {
+  return *(const int *)a - *(const int *)b;
+}
+
+// state for the thread set in d->work, added if it is new
+int reFindState(struct reDfa *d, int n) {
+  int *pcs = d->work;
+  int j;
+  qsort(pcs, n, sizeof(int), reCmpInt);
+  unsigned int h = 2166136261u;
+  for (j = 0; j < n; j++)
+    h = (h ^ pcs[j]) * 16777619u;
+
+  int slot = h & (RE_TABLE_SIZE - 1);
+  while (d->table[slot] != -1) {
+    struct reState *s = &d->states[d->table[slot]];
+    if (s->npcs == n && memcmp(s->pcs, pcs, sizeof(int) * n) == 0)
+      return d->table[slot];
+    slot = (slot + 1) & (RE_TABLE_SIZE - 1);
+  }
+  if (d->nstates == RE_MAX_STATES) {
+    reDfaFlush(d);
+    slot = h & (RE_TABLE_SIZE - 1);
+  }
+
+  if (d->nstates == d->cap) {
+    d->cap = d->cap ? d->cap * 2 : 16;
+    d->states = realloc(d->states, sizeof(struct reState) * d->cap);
+  }
+  struct reState *s = &d->states[d->nstates];
+  memset(s->next, -1, sizeof(s->next));
+  s->pcs = malloc(sizeof(int) * (n ? n : 1));
+  memcpy(s->pcs, pcs, sizeof(int) * n);
+  s->npcs = n;
+  s->match = 0;
+  for (j = 0; j < n; j++)
+    if (d->prog->inst[pcs[j]].op == RE_MATCH)
+      s->match = 1;
+  s->edge = -1;
+  d->table[slot] = d->nstates;
+  return d->nstates++;
+}
+
+int reStart(struct reDfa *d, int atedge) {
+  if (d->start[atedge] == -1) {
+    int n = 0;
+    d->gen++;
+    reAddThread(d, 0, atedge ? 1 << d->startop : 0, &n);
+    d->start[atedge] = reFindState(d, n);
+  }
+  return d->start[atedge];
+}
+
+// builds the transition the first time a byte is read in a state
+int reStep(struct reDfa *d, int s, unsigned char c) {
+  int n = 0;
+  int j;
+  d->gen++;
+  for (j = 0; j < d->states[s].npcs; j++) {
+    int pc = d->states[s].pcs[j];
+    struct reInst *in = &d->prog->inst[pc];
+    if (in->op == RE_SET && (in->set[c >> 5] >> (c & 31)) & 1)
+      reAddThread(d, pc + 1, 0, &n);
+  }
+  if (d->unanchored)
+    reAddThread(d, 0, 0, &n);
+  int flushes = d->flushes;
+  int next = reFindState(d, n);
+  if (d->flushes == flushes)
+    d->states[s].next[c] = next;
+  return next;
+}
+
+// does state s match when the scan has reached the far end of the row
+int reEdge(struct reDfa *d, int s) {
+  struct reState *st = &d->states[s];
+  if (st->edge == -1) {
+    int n = 0;
+    int j;
+    d->gen++;
+    for (j = 0; j < st->npcs; j++)
+      reAddThread(d, st->pcs[j], 1 << d->edgeop, &n);
+    st->edge = 0;
+    for (j = 0; j < n; j++)
+      if (d->prog->inst[d->work[j]].op == RE_MATCH)
+        st->edge = 1;
+  }
+  return st->edge;
+}
+
+// on an empty row both ends hold at once
+int reMatchEmpty(struct reDfa *d) {
+  int n = 0;
+  int j;
+  d->gen++;
+  reAddThread(d, 0, 1 << RE_BOL | 1 << RE_EOL, &n);
+  for (j = 0; j < n; j++)
+    if (d->prog->inst[d->work[j]].op == RE_MATCH)
+      return 1;
+  return 0;
+}
+
+// compile pat, returns -1 if it is not a valid pattern
+int regexCompile(struct regex *re, const char *pat) {
+  struct reParser p = {pat, NULL, 0, 0, 0};
+  int root = reParseAlt(&p);
+  if (*p.p != '\0')
+    p.err = 1; // unbalanced )
+
+  memset(re, 0, sizeof(*re));
+  if (!p.err) {
+    reEmitNode(&re->fwd, p.nodes, root, 0);
+    reEmitInst(&re->fwd, RE_MATCH);
+    reEmitNode(&re->rev, p.nodes, root, 1);
+    reEmitInst(&re->rev, RE_MATCH);
+    if (re->fwd.ninst > RE_MAX_INST)
+      p.err = 1;
+  }
+  free(p.nodes);
+  if (p.err) {
+    free(re->fwd.inst);
+    free(re->rev.inst);
+    return -1;
+  }
+  reDfaInit(&re->any, &re->fwd, 1, 0);
+  reDfaInit(&re->first, &re->rev, 1, 1);
+  reDfaInit(&re->longest, &re->fwd, 0, 0);
+  return 0;
+}
+
+void regexFree(struct regex *re) {
+  reDfaFree(&re->any);
+  reDfaFree(&re->first);
+  reDfaFree(&re->longest);
+  free(re->fwd.inst);
+  free(re->rev.inst);
+}
+
+// 1 if the pattern matches anywhere in text, stops at the first match end
+int regexSearch(struct regex *re, const char *text, int len) {
+  struct reDfa *d = &re->any;
+  if (len == 0)
+    return reMatchEmpty(d);
+  int s = reStart(d, 1);
+  int i;
+  for (i = 0; i < len; i++) {
+    if (d->states[s].match)
+      return 1;
+    unsigned char c = text[i];
+    int next = d->states[s].next[c];
+    s = next != -1 ? next : reStep(d, s, c);
+  }
+  return reEdge(d, s);
+}
+
+// end of the longest match starting at start
+int regexLongest(struct regex *re, const char *text, int len, int start) {
+  struct reDfa *d = &re->longest;
+  int s = reStart(d, start == 0);
+  int end = -1;
+  int i;
+  for (i = start;; i++) {
+    if (i == len ? reEdge(d, s) : d->states[s].match)
+      end = i;
+    if (i == len || d->states[s].npcs == 0)
+      break;
+    unsigned char c = text[i];
+    int next = d->states[s].next[c];
+    s = next != -1 ? next : reStep(d, s, c);
+  }
+  return end;
+}
+
+// leftmost longest match starting at or after from, its length goes to
+// *mlen. returns -1 if there is none
+int regexFind(struct regex *re, const char *text, int len, int from,
+              int *mlen) {
+  if (len == 0) {
+    *mlen = 0;
+    return reMatchEmpty(&re->any) ? 0 : -1;
+  }
+
+  // the reversed pattern read from the end accepts wherever a match
+  // starts, the last place it does is the leftmost one
+  struct reDfa *d = &re->first;
+  int s = reStart(d, 1);
+  int start = d->states[s].match ? len : -1;
+  int i;
+  for (i = len; i > from; i--) {
+    unsigned char c = text[i - 1];
+    int next = d->states[s].next[c];
+    s = next != -1 ? next : reStep(d, s, c);
+    if (i - 1 == 0 ? reEdge(d, s) : d->states[s].match)
+      start = i - 1;
+  }
+  if (start == -1)
+    return -1;
+  *mlen = regexLongest(re, text, len, start) - start;
+  return start;
+}
+
+/*** search ***/
+
+// a query compiled once per prompt keystroke and then run over every row
+// short patterns are found with a vector filter on their first and last
+// byte, long ones with horspool which can skip up to the pattern length
+#define SEARCH_HORSPOOL_MIN 32
+
+void searchCompile(struct searchQuery *q, const char *pat) {
+  int j;
+  q->pat = pat;
+  q->len = strlen(pat);
+#if defined(__x86_64__) || defined(__i386__)
+  q->avx2 = __builtin_cpu_supports("avx2");
+#else
+  q->avx2 = 0;
+#endif
+  for (j = 0; j < 256; j++)
+    q->skip[j] = q->len;
+  for (j = 0; j < q->len - 1; j++)
+    q->skip[(unsigned char)pat[j]] = q->len - 1 - j;
+
+  q->re = NULL;
+  q->invalid = 0;
+  if (E.regex) {
+    q->re = malloc(sizeof(struct regex));
+    if (regexCompile(q->re, pat) == -1) {
+      free(q->re);
+      q->re = NULL;
+      q->invalid = 1;
+    }
+  }
+}
+
+void searchFree(struct searchQuery *q) {
+  if (q->re) {
+    regexFree(q->re);
+    free(q->re);
+    q->re = NULL;
+  }
+}
+
+// vector filters check candidates starting before *pos and leave the rest
+// to searchHorspool. they need len >= 2 so the middle compare is valid
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) int
+searchFilterAvx2(struct searchQuery *q, const char *text, int len, int *pos) {
+  int n = q->len;
+  __m256i first = _mm256_set1_epi8(q->pat[0]);
+  __m256i last = _mm256_set1_epi8(q->pat[n - 1]);
+  int i;
+  for (i = *pos; i + n - 1 + 32 <= len; i += 32) {
+    __m256i bf = _mm256_loadu_si256((const __m256i *)(text + i));
+    __m256i bl = _mm256_loadu_si256((const __m256i *)(text + i + n - 1));
+    unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(
+        _mm256_cmpeq_epi8(bf, first), _mm256_cmpeq_epi8(bl, last)));
+    while (mask) {
+      int j = i + __builtin_ctz(mask);
+      if (memcmp(text + j + 1, q->pat + 1, n - 2) == 0)
+        return j;
+      mask &= mask - 1;
+    }
+  }
+  *pos = i;
+  return -1;
+}
+#endif
+
+#ifdef __SSE2__
+int searchFilterSse2(struct searchQuery *q, const char *text, int len,
+                     int *pos) {
+  int n = q->len;
+  __m128i first = _mm_set1_epi8(q->pat[0]);
+  __m128i last = _mm_set1_epi8(q->pat[n - 1]);
+  int i;
+  for (i = *pos; i + n - 1 + 16 <= len; i += 16) {
+    __m128i bf = _mm_loadu_si128((const __m128i *)(text + i));
+    __m128i bl = _mm_loadu_si128((const __m128i *)(text + i + n - 1));
+    unsigned int mask = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(bf, first), _mm_cmpeq_epi8(bl, last)));
+    while (mask) {
+      int j = i + __builtin_ctz(mask);
+      if (memcmp(text + j + 1, q->pat + 1, n - 2) == 0)
+        return j;
+      mask &= mask - 1;
+    }
+  }
+  *pos = i;
+  return -1;
+}
+#endif
+
+int searchHorspool(struct searchQuery *q, const char *text, int len, int i) {
+  int n = q->len;
+  unsigned char last = q->pat[n - 1];
+  while (i + n <= len) {
+    unsigned char c = text[i + n - 1];
+    if (c == last && memcmp(text + i, q->pat, n - 1) == 0)
+      return i;
+    i += q->skip[c];
+  }
+  return -1;
+}
+
+// offset of the first match in text, -1 if none
+// an empty query matches at 0 like strstr
+int searchFind(struct searchQuery *q, const char *text, int len) {
+  if (q->invalid)
+    return -1;
+  if (q->re) {
+    int mlen;
+    if (!regexSearch(q->re, text, len))
+      return -1;
+    return regexFind(q->re, text, len, 0, &mlen);
+  }
+  if (q->len == 0)
+    return 0;
+  if (q->len == 1) {
+    const char *p = memchr(text, q->pat[0], len);
+    return p ? p - text : -1;
+  }
+
+  int pos = 0;
+  if (q->len < SEARCH_HORSPOOL_MIN) {
+    int match = -1;
+#if defined(__x86_64__) || defined(__i386__)
+    if (q->avx2)
+      match = searchFilterAvx2(q, text, len, &pos);
+#endif
+#ifdef __SSE2__
+    if (match == -1)
+      match = searchFilterSse2(q, text, len, &pos);
+#endif
+    if (match != -1)
+      return match;
+  }
+  return searchHorspool(q, text, len, pos);
 }
 
-// insert character c at row[at]
-void editorRowInsertChar(erow *row, int at, int c) {
-  // if index invalid set to end of line
-  if (at < 0 || at > row->size)
-    at = row->size;
-  // 1 for char and 1 because size doesn't include null at end of row->chars
-  row->chars = realloc(row->chars, row->size + 2);
-  memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-  row->size++;
-  row->chars[at] = c;
-  editorUpdateRow(row);
-  E.dirty++;
+// first match starting at or after from, its length goes to *mlen
+// anchors still see the whole text, so ^ never matches past its start
+int searchNext(struct searchQuery *q, const char *text, int len, int from,
+               int *mlen) {
+  if (q->invalid)
+    return -1;
+  if (q->re)
+    return regexFind(q->re, text, len, from, mlen);
+  int m = searchFind(q, text + from, len - from);
+  *mlen = q->len;
+  return m == -1 ? -1 : from + m;
 }
 
-void editorRowAppendString(erow *row, char *s, size_t len) {
-  // len won't include NULL neither does row size
-  // but row->chars has it so add + 1
-  row->chars = realloc(row->chars, row->size + len + 1);
-  memcpy(&row->chars[row->size], s, len);
-  row->size += len;
-  row->chars[row->size] = '\0';
-  editorUpdateRow(row);
-  E.dirty++;
+void searchPopLevel(struct searchCache *c) {
+  struct searchLevel *l = &c->levels[--c->nlevels];
+  free(l->query);
+  free(l->rows);
+  free(l->offs);
 }
 
-// how would backspace behave on an empty row?
-void editorRowDelChar(erow *row, int at) {
-  if (at < 0 || at >= row->size)
-    return;
-  // we copy the '\0' as well
-  memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-  row->size--;
-  editorUpdateRow(row);
-  E.dirty++;
+void searchReset(struct searchCache *c) {
+  while (c->nlevels)
+    searchPopLevel(c);
 }
 
-// holds operations that will be called from editorProcessKeypress
-/*** editor operations ***/
+// rows handed to each search task
+#define SEARCH_CHUNK_ROWS 16384
+
+struct searchScan {
+  char *query;
+  struct searchLevel *parent; // rows to check, every row if NULL
+  int chunk;
+  int *rows;   // matches of chunk i start at rows[i * chunk]
+  int *offs;   // and their first match at offs[i * chunk], NULL for regex
+  int *counts; // matches found by each chunk
+  int bulk;    // runs of unedited rows are searched as one text, see searchSpan
+  // the query is compiled once per scan. a literal one is only read and
+  // all chunks share it, a regex fills in its dfa while it runs so a
+  // chunk takes one nobody is using and puts it back when done
+  struct searchQuery shared;
+  pthread_mutex_t lock;
+  struct searchQuery **spare;
+  int nspare;
+};
 
-void editorInsertChar(int c) {
-  // insert row if on last line
-  if (E.cy == E.numrows) {
-    editorInsertRow(E.numrows, "", 0);
+struct searchQuery *searchScanQuery(struct searchScan *scan) {
+  if (!scan->shared.re)
+    return &scan->shared;
+  struct searchQuery *q = NULL;
+  pthread_mutex_lock(&scan->lock);
+  if (scan->nspare)
+    q = scan->spare[--scan->nspare];
+  pthread_mutex_unlock(&scan->lock);
+  if (!q) {
+    q = malloc(sizeof(*q));
+    searchCompile(q, scan->query);
   }
-  editorRowInsertChar(&E.row[E.cy], E.cx, c);
-  E.cx++;
+  return q;
 }
 
-void editorInsertNewline() {
-  if (E.cx == 0) {
-    editorInsertRow(E.cy, "", 0);
-  } else {
-    // move the rest of the line to new line
-    erow *row = &E.row[E.cy];
-    editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
-    row = &E.row[E.cy];
-    row->size = E.cx;
-    row->chars[row->size] = '\0';
-    editorUpdateRow(row);
-  }
-  E.cy++;
-  E.cx = 0;
+void searchScanDone(struct searchScan *scan, struct searchQuery *q) {
+  if (!scan->shared.re)
+    return;
+  pthread_mutex_lock(&scan->lock);
+  scan->spare[scan->nspare++] = q;
+  pthread_mutex_unlock(&scan->lock);
 }
 
-void editorDelChar() {
-  // passed end of file
-  if (E.cy == E.numrows)
-    return;
-  // start of file
-  if (E.cx == 0 && E.cy == 0)
-    return;
+// matches in n unedited rows from document row at, which are map[from..to)
+// searched in one go. a match can't cross a line so every hit gives its
+// row, and the search goes on from the start of the next one
+int searchSpan(struct searchQuery *q, int at, int n, size_t from, size_t to,
+               int *out, int *offs) {
+  uint64_t *lineoff = E.tb.lineoff;
+  // index of the first row in lineoff, from is one of its entries
+  int first = 0, hi = E.tb.nlines;
+  while (first < hi) {
+    int mid = first + (hi - first) / 2;
+    if (lineoff[mid] < from)
+      first = mid + 1;
+    else
+      hi = mid;
+  }
+  int count = 0;
+  int r = 0;
+  size_t pos = from;
+  while (pos < to) {
+    size_t len = to - pos < INT_MAX ? to - pos : INT_MAX;
+    int m = searchFind(q, E.tb.map + pos, len);
+    if (m == -1) {
+      if (len < to - pos) {
+        // the text was cut, go on from before the cut
+        pos += len - q->len + 1;
+        continue;
+      }
+      break;
+    }
+    size_t hit = pos + m;
+    while (lineoff[first + r + 1] <= hit)
+      r++;
+    out[count] = at + r;
+    offs[count++] = hit - lineoff[first + r];
+    r++;
+    if (r >= n)
+      break;
+    pos = lineoff[first + r];
+  }
+  return count;
+}
 
-  erow *row = &E.row[E.cy];
-  if (E.cx > 0) {
-    editorRowDelChar(row, E.cx - 1);
-    E.cx--;
-  } else {
-    // cursor will be placed at current end of line above
-    E.cx = E.row[E.cy - 1].size;
-    editorRowAppendString(&E.row[E.cy - 1], row->chars, row->size);
-    editorDelRow(E.cy);
-    E.cy--;
+void searchScanChunk(void *arg, int i) {
+  struct searchScan *scan = arg;
+  struct searchLevel *parent = scan->parent;
+  struct tbCursor c = {0, 0};
+  struct searchQuery *q = searchScanQuery(scan);
+  int n = parent ? parent->nrows : E.numrows;
+  int from = i * scan->chunk;
+  int to = from + scan->chunk < n ? from + scan->chunk : n;
+  int *out = &scan->rows[from];
+  int *offs = scan->offs ? &scan->offs[from] : NULL;
+  int count = 0;
+  int j;
+  for (j = from; j < to; j++) {
+    int at = parent ? parent->rows[j] : j;
+    size_t sfrom, sto;
+    int nspan = scan->bulk ? tbSpan(&E.tb, &c, j, to - j, &sfrom, &sto) : 0;
+    if (nspan > 1) {
+      count += searchSpan(q, j, nspan, sfrom, sto, &out[count], &offs[count]);
+      j += nspan - 1;
+      continue;
+    }
+    int size;
+    const char *text = tbText(&E.tb, &c, at, &size);
+    if (!offs) {
+      if (searchFind(q, text, size) != -1)
+        out[count++] = at;
+      continue;
+    }
+    // typing one more char mostly keeps the match where it was, a compare
+    // there is cheaper than setting up a search of the rest of the row
+    int start = parent && parent->offs ? parent->offs[j] : 0;
+    int mlen;
+    int m = start;
+    if (start + q->len > size || memcmp(text + start, q->pat, q->len) != 0)
+      m = searchNext(q, text, size, start, &mlen);
+    if (m != -1) {
+      offs[count] = m;
+      out[count++] = at;
+    }
   }
+  scan->counts[i] = count;
+  searchScanDone(scan, q);
 }
 
-/*** file i/o ***/
+// sorted rows containing query, narrowed from the longest cached prefix
+// of it. returns NULL for the empty query, which matches every row
+// a longer regex can match more rows than its prefix, so only an equal
+// one is reused in regex mode
+struct searchLevel *searchResults(struct searchCache *c, char *query) {
+  while (c->nlevels) {
+    struct searchLevel *top = &c->levels[c->nlevels - 1];
+    if (E.regex ? strcmp(top->query, query) == 0
+                : strncmp(top->query, query, strlen(top->query)) == 0)
+      break;
+    searchPopLevel(c);
+  }
+  if (query[0] == '\0')
+    return NULL;
+
+  struct searchLevel *parent = c->nlevels ? &c->levels[c->nlevels - 1] : NULL;
+  if (parent && strcmp(parent->query, query) == 0)
+    return parent;
+
+  // a fresh scan only has to look at rows the trigram index can't rule out
+  struct searchLevel cand = {NULL, NULL, 0, NULL};
+  if (!parent) {
+    cand.rows = trigramCandidates(query, &cand.nrows);
+    if (cand.rows)
+      parent = &cand;
+  }
 
-char *editorRowsToString(int *buflen) {
-  int totlen = 0;
+  // a literal query extending its parent matches no row the parent didn't,
+  // but going through a parent that holds a good part of the rows one by
+  // one costs more than searching the whole file text again
+  int literal = !E.regex && !strpbrk(query, "\r\n");
+  if (literal && parent && parent->nrows > E.numrows / 3 &&
+      E.tb.nown + E.tb.add.len < E.numrows / 4)
+    parent = NULL;
+
+  struct searchScan scan;
+  scan.query = query;
+  scan.parent = parent;
+  scan.bulk = literal && !parent;
+  int n = parent ? parent->nrows : E.numrows;
+  scan.rows = malloc(sizeof(int) * (n ? n : 1));
+  scan.offs = E.regex ? NULL : malloc(sizeof(int) * (n ? n : 1));
+  scan.chunk = SEARCH_CHUNK_ROWS;
+  searchCompile(&scan.shared, query);
+
+  // big scans are split across the worker pool, each chunk writes its
+  // matches from the start of its own slice of rows
+  int nchunks = (n + scan.chunk - 1) / scan.chunk;
+  scan.counts = malloc(sizeof(int) * (nchunks ? nchunks : 1));
+  scan.spare = malloc(sizeof(struct searchQuery *) * (nchunks + 1));
+  scan.nspare = 0;
+  if (scan.shared.re)
+    scan.spare[scan.nspare++] = &scan.shared;
+  pthread_mutex_init(&scan.lock, NULL);
+  if (nchunks > 1)
+    editorParallel(searchScanChunk, &scan, nchunks);
+  else if (nchunks == 1)
+    searchScanChunk(&scan, 0);
+
+  // close the gaps between chunks, keeping rows in order
+  int nrows = 0;
   int j;
-  for (j = 0; j < E.numrows; j++)
-    totlen += E.row[j].size + 1;
-  *buflen = totlen;
+  for (j = 0; j < nchunks; j++) {
+    memmove(&scan.rows[nrows], &scan.rows[j * scan.chunk],
+            sizeof(int) * scan.counts[j]);
+    if (scan.offs)
+      memmove(&scan.offs[nrows], &scan.offs[j * scan.chunk],
+              sizeof(int) * scan.counts[j]);
+    nrows += scan.counts[j];
+  }
+  for (j = 0; j < scan.nspare; j++) {
+    if (scan.spare[j] == &scan.shared)
+      continue;
+    searchFree(scan.spare[j]);
+    free(scan.spare[j]);
+  }
+  pthread_mutex_destroy(&scan.lock);
+  free(scan.spare);
+  searchFree(&scan.shared);
+  free(scan.counts);
+  free(cand.rows);
+
+  if (c->nlevels == c->cap) {
+    c->cap = c->cap ? c->cap * 2 : 16;
+    c->levels = realloc(c->levels, sizeof(struct searchLevel) * c->cap);
+  }
+  struct searchLevel *l = &c->levels[c->nlevels++];
+  l->query = strdup(query);
+  l->rows = scan.rows;
+  l->nrows = nrows;
+  l->offs = scan.offs;
+  return l;
+}
 
-  char *buf = malloc(totlen);
-  char *p = buf;
-  for (j = 0; j < E.numrows; j++) {
-    memcpy(p, E.row[j].chars, E.row[j].size);
-    p += E.row[j].size;
-    *p = '\n';
-    p++;
+// next matching row after row at in direction, wrapping around
+// at == -1 starts from the top. returns -1 if nothing matches
+int searchNextRow(struct searchLevel *l, int at, int direction) {
+  if (!l) {
+    if (E.numrows == 0)
+      return -1;
+    if (at == -1)
+      return 0;
+    return (at + direction + E.numrows) % E.numrows;
   }
-  return buf;
+  if (l->nrows == 0)
+    return -1;
+  if (at == -1)
+    return l->rows[0];
+
+  // first index with rows[lo] > at
+  int lo = 0, hi = l->nrows;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (l->rows[mid] <= at)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (direction == 1)
+    return lo < l->nrows ? l->rows[lo] : l->rows[0];
+  // step back over at itself if it matched
+  int k = lo - 1;
+  if (k >= 0 && l->rows[k] == at)
+    k--;
+  return k >= 0 ? l->rows[k] : l->rows[l->nrows - 1];
 }
 
-void editorOpen(char *filename) {
-  free(E.filename);
-  E.filename = strdup(filename);
+// start painting every match of query, NULL or "" stops it
+// rows keep their matches until the generation moves on
+void editorSetHighlight(char *query) {
+  if (query && query[0] == '\0')
+    query = NULL;
+  if (!query && !E.hlquery)
+    return;
+  if (query && E.hlquery && strcmp(query, E.hlquery) == 0)
+    return;
 
-  FILE *fp = fopen(filename, "r");
-  if (!fp)
-    die("fopen");
-
-  char *line = NULL;
-  size_t linecap = 0;
-  ssize_t linelen;
-  while ((linelen = getline(&line, &linecap, fp)) != -1) {
-    while (linelen > 0 &&
-           (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
-      linelen--;
-    editorInsertRow(E.numrows, line, linelen);
-  }
-  free(line);
-  fclose(fp);
-  // open calls editorAppendRow which dirties buffer
-  E.dirty = 0;
+  free(E.hlquery);
+  searchFree(&E.hlq);
+  E.hlquery = query ? strdup(query) : NULL;
+  if (E.hlquery)
+    searchCompile(&E.hlq, E.hlquery);
+  E.matchgen++;
 }
 
-void editorSave() {
-  if (E.filename == NULL) {
-    E.filename = editorPrompt("Save as: %s", NULL);
-    if (E.filename == NULL) {
-      editorSetStatusMessage("Save aborted");
-      return;
-    }
-  }
-
-  int len;
-  char *buf = editorRowsToString(&len);
-  int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
-  if (fd != -1) {
-    if (ftruncate(fd, len) != -1) {
-      if (write(fd, buf, len) != -1) {
-        close(fd);
-        free(buf);
-        E.dirty = 0;
-        editorSetStatusMessage("%d bytes written to disk", len);
-        return;
-      }
-    }
-    close(fd);
+// matches of E.hlquery in a row, only searched again if the query or the
+// row changed since last time
+void editorRowMatches(erow *row) {
+  if (row->matchgen == E.matchgen)
+    return;
+  row->nmatches = 0;
+  int at = 0;
+  while (at <= row->size) {
+    int mlen;
+    int m = searchNext(&E.hlq, row->chars, row->size, at, &mlen);
+    if (m == -1)
+      break;
+    // empty regex matches paint nothing, step over them
+    at = mlen ? m + mlen : m + 1;
+    if (mlen == 0)
+      continue;
+    row->matches = arenaRealloc(&E.tb.arena, row->matches,
+                                sizeof(int) * 2 * (row->nmatches + 1));
+    row->matches[row->nmatches * 2] = m;
+    row->matches[row->nmatches * 2 + 1] = m + mlen;
+    row->nmatches++;
   }
-  free(buf);
-  editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+  row->matchgen = E.matchgen;
 }
 
 /*** find ***/
@@ -591,14 +3879,32 @@ void editorFindCallback(char *query, int key) {
   static char *saved_hl = NULL;
 
   if (saved_hl) {
-    memcpy(E.row[saved_hl_line].hl, saved_hl, E.row[saved_hl_line].rsize);
+    erow *row = editorRowRender(tbRow(&E.tb, saved_hl_line));
+    memcpy(row->hl, saved_hl, row->rsize);
     free(saved_hl);
     saved_hl = NULL;
   }
 
+  if (key == '\x1b')
+    editorSetHighlight(NULL);
+  else if (E.hlsearch)
+    editorSetHighlight(query);
+
+  // a regex that does not compile matches nothing, it is reported once
+  // the prompt is closed since the prompt redraws over the status message
+  struct searchQuery q;
+  searchCompile(&q, query);
+  if (q.invalid) {
+    if (key == '\r')
+      editorSetStatusMessage("Invalid regex: %s", query);
+    key = '\r';
+  }
+
   if (key == '\r' || key == '\x1b') {
     last_match = -1;
     direction = 1;
+    searchReset(&E.search);
+    searchFree(&q);
     return;
   } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
     direction = 1;
@@ -611,42 +3917,41 @@ void editorFindCallback(char *query, int key) {
 
   if (last_match == -1)
     direction = 1;
-  int current = last_match;
 
-  int i;
-  for (i = 0; i < E.numrows; i++) {
-    current += direction;
-    if (current == -1)
-      current = E.numrows - 1;
-    else if (current == E.numrows)
-      current = 0;
-
-    erow *row = &E.row[current];
-    // return char* to first char of match
-    // if no match returns NULL
-    // if empty search returns haystack
-    char *match = strstr(row->render, query);
-    if (match) {
-      last_match = current;
-      E.cy = current;
-      E.cx = editorRowRxToCx(row, match - row->render);
-      // causes editorScroll to scroll up to our match line
-      E.rowoff = E.numrows;
-
-      // save line with match
-      saved_hl = malloc(row->rsize);
-      memcpy(saved_hl, row->hl, row->rsize);
-
-      // set match color
-      memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
-      break;
-    }
+  // rows are only scanned when the query changed, arrows walk the cached set
+  int current =
+      searchNextRow(searchResults(&E.search, query), last_match, direction);
+  if (current == -1) {
+    searchFree(&q);
+    return;
   }
+
+  erow *row = tbRow(&E.tb, current);
+  // offset of first char of match in chars, which is where the cursor goes
+  // if empty search returns 0
+  int mlen;
+  int match = searchNext(&q, row->chars, row->size, 0, &mlen);
+  searchFree(&q);
+
+  last_match = current;
+  E.cy = current;
+  E.cx = match;
+  // causes editorScroll to scroll up to our match line
+  E.rowoff = E.numrows;
+
+  // save line with match, its state is settled first so drawing it
+  // doesn't rebuild hl and drop the match color
+  editorSyntaxWant(current + 1);
+  editorRowRender(row);
+  saved_hl_line = current;
+  saved_hl = malloc(row->rsize);
+  memcpy(saved_hl, row->hl, row->rsize);
+
+  // set match color, a tab inside the match widens it on screen
+  int from = editorRowCxToRx(row, match);
+  memset(&row->hl[from], HL_MATCH, editorRowCxToRx(row, match + mlen) - from);
 }
 
-// TODO
-// why are we searching in row->render and converting cx to rx
-// instead of searching in row->chars
 void editorFind() {
   // save and restore cursor position if search cancelled
   int saved_cx = E.cx;
@@ -655,7 +3960,9 @@ void editorFind() {
   int saved_rowoff = E.rowoff;
 
   char *query =
-      editorPrompt("Search: %s (Use ESC/Arrows/Enter)", editorFindCallback);
+      editorPrompt(E.regex ? "Regex: %s (Use ESC/Arrows/Enter)"
+                           : "Search: %s (Use ESC/Arrows/Enter)",
+                   editorFindCallback);
   if (query) {
     free(query);
   } else {
@@ -668,37 +3975,322 @@ void editorFind() {
 
 /*** append buffer ***/
 
-// we do this to avoid doing so many writes
-// just append to this buffer and write once
-// dynamic string buffer with append method
-struct abuf {
-  char *b;
-  int len;
-};
-
-#define ABUF_INIT                                                              \
-  { NULL, 0 }
-
+// capacity doubles when full and E.out is reused across frames, so once
+// it has grown to fit a full screen a refresh allocates nothing
 void abAppend(struct abuf *ab, const char *s, int len) {
-  // allocate en
-  char *new = realloc(ab->b, ab->len + len);
-
-  if (new == NULL)
+  // an empty buffer has no b to copy into yet
+  if (len == 0)
     return;
-  memcpy(&new[ab->len], s, len);
-  ab->b = new;
+  if (ab->len + len > ab->cap) {
+    int cap = ab->cap ? ab->cap : 4096;
+    while (cap < ab->len + len)
+      cap *= 2;
+    char *new = realloc(ab->b, cap);
+    if (new == NULL)
+      return;
+    ab->b = new;
+    ab->cap = cap;
+    ab->allocs++;
+  }
+  memcpy(&ab->b[ab->len], s, len);
   ab->len += len;
 }
 
 void abFree(struct abuf *ab) { free(ab->b); }
 
+/*** replace ***/
+
+// cut the field at *p off at delim, which a backslash escapes, and move
+// *p past it. returns 0 if the field ran to the end of the command
+int editorReplaceField(char **p, char delim) {
+  char *out = *p;
+  char *s = *p;
+  while (*s && *s != delim) {
+    if (s[0] == '\\' && s[1] == delim)
+      s++;
+    *out++ = *s++;
+  }
+  int found = *s == delim;
+  *p = found ? s + 1 : s;
+  *out = '\0';
+  return found;
+}
+
+// :[%]s/pattern/replacement/[g]. % works on every row instead of the
+// cursor row and g replaces every match in a row instead of the first.
+// each changed row is rebuilt once from its matches
+void editorReplace(char *cmd) {
+  int all = 0;
+  if (*cmd == '%') {
+    all = 1;
+    cmd++;
+  }
+  // the closing delimiter may be left out like in vim
+  char delim = cmd[1];
+  char *pat = &cmd[2];
+  char *p = pat;
+  int ok = delim && editorReplaceField(&p, delim);
+  char *rep = p;
+  editorReplaceField(&p, delim);
+  if (!ok || (*p && strcmp(p, "g") != 0)) {
+    editorSetStatusMessage("Usage: [%%]s/pattern/replacement/[g]");
+    return;
+  }
+  if (*pat == '\0') {
+    editorSetStatusMessage("Empty pattern");
+    return;
+  }
+  int global = *p == 'g';
+  int replen = strlen(rep);
+
+  struct searchQuery q;
+  searchCompile(&q, pat);
+  if (q.invalid) {
+    editorSetStatusMessage("Invalid regex: %s", pat);
+    return;
+  }
+
+  // rows to rewrite come from the same scan the search prompt uses
+  struct searchCache cache = {NULL, 0, 0};
+  struct searchLevel *l = NULL;
+  struct searchLevel cur = {NULL, &E.cy, 1, NULL};
+  if (all)
+    l = searchResults(&cache, pat);
+  else if (E.cy < E.numrows)
+    l = &cur;
+
+  struct abuf ab = ABUF_INIT;
+  int subs = 0;
+  int rows = 0;
+  int j;
+  struct tbCursor c = {0, 0};
+  for (j = 0; l && j < l->nrows; j++) {
+    // rows are matched through their text, only rewritten ones get an erow
+    int size;
+    const char *text = tbText(&E.tb, &c, l->rows[j], &size);
+    ab.len = 0;
+    int at = 0;
+    int last = -1; // end of the previous match
+    int n = 0;
+    while (at <= size) {
+      int mlen;
+      int m = searchNext(&q, text, size, at, &mlen);
+      if (m == -1)
+        break;
+      // an empty match keeps the char after it, and is skipped right
+      // where another match ended
+      if (mlen == 0 && m == last) {
+        if (m < size)
+          abAppend(&ab, &text[m], 1);
+        at = m + 1;
+        continue;
+      }
+      abAppend(&ab, &text[at], m - at);
+      abAppend(&ab, rep, replen);
+      n++;
+      at = last = m + mlen;
+      if (mlen == 0) {
+        if (at < size)
+          abAppend(&ab, &text[at], 1);
+        at++;
+      }
+      if (!global)
+        break;
+    }
+    if (n == 0)
+      continue;
+    if (at < size)
+      abAppend(&ab, &text[at], size - at);
+
+    erow *row = tbRow(&E.tb, l->rows[j]);
+    if (tbMapped(&E.tb, row))
+      tbOwn(&E.tb, row);
+    else
+      arenaFree(&E.tb.arena, row->chars);
+    row->chars = arenaAlloc(&E.tb.arena, ab.len + 1);
+    memcpy(row->chars, ab.b, ab.len);
+    row->chars[ab.len] = '\0';
+    row->size = ab.len;
+    trigramAddText(row, 0, row->size);
+    editorInvalidateRow(row);
+    editorSyntaxStale(l->rows[j]);
+    subs += n;
+    rows++;
+  }
+  abFree(&ab);
+  searchFree(&q);
+  searchReset(&cache);
+  free(cache.levels);
+
+  if (rows == 0) {
+    editorSetStatusMessage("Pattern not found: %s", pat);
+    return;
+  }
+  E.dirty += rows;
+  if (E.cy < E.numrows && E.cx > tbRow(&E.tb, E.cy)->size)
+    E.cx = tbRow(&E.tb, E.cy)->size;
+  editorSetStatusMessage("%d substitution%s on %d line%s", subs,
+                         subs == 1 ? "" : "s", rows, rows == 1 ? "" : "s");
+}
+
+/*** screen ***/
+
+void screenInit(struct screen *scr, int rows, int cols) {
+  scr->rows = rows;
+  scr->cols = cols;
+  scr->rowoff = 0;
+  scr->chars = malloc(rows * cols);
+  scr->attrs = malloc(rows * cols);
+  // nothing we draw is a '\0', so the first flush repaints every cell
+  memset(scr->chars, '\0', rows * cols);
+  memset(scr->attrs, 0, rows * cols);
+}
+
+// write len chars at y,x, clipped to the right edge
+void screenPut(struct screen *scr, int y, int x, const char *s, int len,
+               int attr) {
+  if (x + len > scr->cols)
+    len = scr->cols - x;
+  if (len <= 0)
+    return;
+  memcpy(&scr->chars[y * scr->cols + x], s, len);
+  memset(&scr->attrs[y * scr->cols + x], attr, len);
+}
+
+void screenClearRow(struct screen *scr, int y, int attr) {
+  memset(&scr->chars[y * scr->cols], ' ', scr->cols);
+  memset(&scr->attrs[y * scr->cols], attr, scr->cols);
+}
+
+int editorAttrToSgr(int attr, char *buf, int bufsize) {
+  if (attr == 0)
+    return snprintf(buf, bufsize, "\x1b[m");
+  return snprintf(buf, bufsize, "\x1b[0;%d%sm", attr & ~ATTR_INVERSE,
+                  (attr & ATTR_INVERSE) ? ";7" : "");
+}
+
+// scroll screen rows top..bottom-1 up by n lines (down if n < 0) using a
+// scroll region, and shift E.shown to match so only the rows that came in
+// blank are left for editorFlushScreen to draw
+void editorScrollShown(struct abuf *ab, int top, int bottom, int n) {
+  struct screen *scr = &E.shown;
+  int cols = scr->cols;
+  int count = n > 0 ? n : -n;
+  char buf[32];
+  int len;
+
+  len = snprintf(buf, sizeof(buf), "\x1b[%d;%dr", top + 1, bottom);
+  abAppend(ab, buf, len);
+  len = snprintf(buf, sizeof(buf), "\x1b[%d%c", count, n > 0 ? 'S' : 'T');
+  abAppend(ab, buf, len);
+  // reset scroll region to the full screen
+  abAppend(ab, "\x1b[r", 3);
+
+  int moved = (bottom - top - count) * cols;
+  int from = (n > 0 ? top + count : top) * cols;
+  int to = (n > 0 ? top : top + count) * cols;
+  int blank = (n > 0 ? bottom - count : top) * cols;
+  memmove(&scr->chars[to], &scr->chars[from], moved);
+  memmove(&scr->attrs[to], &scr->attrs[from], moved);
+  memset(&scr->chars[blank], ' ', count * cols);
+  memset(&scr->attrs[blank], 0, count * cols);
+  scr->rowoff += n;
+}
+
+// append cells from..to-1 of one row
+// each run of cells sharing an attribute costs one sgr and one copy
+void editorEmitCells(struct abuf *ab, char *chars, unsigned char *attrs,
+                     int from, int to, int *attr) {
+  int x = from;
+  while (x < to) {
+    int run = x + 1;
+    while (run < to && attrs[run] == attrs[x])
+      run++;
+    if (attrs[x] != *attr) {
+      char buf[32];
+      *attr = attrs[x];
+      abAppend(ab, buf, editorAttrToSgr(*attr, buf, sizeof(buf)));
+    }
+    abAppend(ab, &chars[x], run - x);
+    x = run;
+  }
+}
+
+// append escape sequences turning the terminal from E.shown into E.frame
+// only cells that differ are written, everything else is skipped with a
+// cursor move. returns the number of cells written
+int editorFlushScreen(struct abuf *ab) {
+  struct screen *old = &E.shown;
+  struct screen *new = &E.frame;
+  int cols = new->cols;
+  int written = 0;
+  int attr = -1; // sgr state of the terminal, unknown at start
+  int y, x;
+
+  for (y = 0; y < new->rows; y++) {
+    char *nc = &new->chars[y * cols];
+    unsigned char *na = &new->attrs[y * cols];
+    char *oc = &old->chars[y * cols];
+    unsigned char *oa = &old->attrs[y * cols];
+    if (memcmp(nc, oc, cols) == 0 && memcmp(na, oa, cols) == 0)
+      continue;
+
+    // blank tail of the new row, cleared with one erase-line
+    int tail = cols;
+    while (tail > 0 && nc[tail - 1] == ' ' && na[tail - 1] == 0)
+      tail--;
+
+    int cx = -1; // terminal cursor column, -1 if not on this row
+    for (x = 0; x < cols; x++) {
+      if (nc[x] == oc[x] && na[x] == oa[x])
+        continue;
+
+      // short gaps of unchanged cells are cheaper to rewrite than to jump
+      if (cx == -1 || x - cx > 4) {
+        char buf[32];
+        int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, x + 1);
+        abAppend(ab, buf, len);
+        cx = x;
+      }
+
+      if (x >= tail) {
+        if (cx < tail) {
+          editorEmitCells(ab, nc, na, cx, tail, &attr);
+          written += tail - cx;
+        }
+        if (attr != 0) {
+          abAppend(ab, "\x1b[m", 3);
+          attr = 0;
+        }
+        abAppend(ab, "\x1b[K", 3);
+        written += cols - x;
+        break;
+      }
+
+      editorEmitCells(ab, nc, na, cx, x + 1, &attr);
+      written += x + 1 - cx;
+      cx = x + 1;
+      // writing the last column leaves the cursor in a pending wrap state
+      if (cx == cols)
+        cx = -1;
+    }
+  }
+  if (attr > 0)
+    abAppend(ab, "\x1b[m", 3);
+
+  struct screen tmp = E.shown;
+  E.shown = E.frame;
+  E.frame = tmp;
+  return written;
+}
+
 /*** output ***/
 
 // scroll if row[cy] is outside viewport
 void editorScroll() {
   E.rx = 0;
   if (E.cy < E.numrows) {
-    E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+    E.rx = editorRowCxToRx(tbRow(&E.tb, E.cy), E.cx);
   }
 
   if (E.cy < E.rowoff) {
@@ -718,9 +4310,12 @@ void editorScroll() {
   }
 }
 
-void editorDrawRows(struct abuf *ab) {
+void editorDrawRows(struct screen *scr) {
   int y;
+  scr->rowoff = E.rowoff;
+  editorSyntaxWant(E.rowoff + E.screenrows);
   for (y = 0; y < E.screenrows; y++) {
+    screenClearRow(scr, y, 0);
     // get absolute row wrt file start
     // is filerow name misleading?
     int filerow = y + E.rowoff;
@@ -734,60 +4329,57 @@ void editorDrawRows(struct abuf *ab) {
           welcomelen = E.screencols;
         // center it
         int padding = (E.screencols - welcomelen) / 2;
-        if (padding) {
-          abAppend(ab, "~", 1);
-          padding--;
-        }
-        while (padding--)
-          abAppend(ab, " ", 1);
-
-        abAppend(ab, welcome, welcomelen);
+        if (padding)
+          screenPut(scr, y, 0, "~", 1, 0);
+        screenPut(scr, y, padding, welcome, welcomelen, 0);
       } else {
         // append '~' to empty lines below editable area
-        abAppend(ab, "~", 1);
+        screenPut(scr, y, 0, "~", 1, 0);
       }
     } else {
-      int len = E.row[filerow].rsize - E.coloff;
+      erow *row = editorRowRender(tbRow(&E.tb, filerow));
+      int len = row->rsize - E.coloff;
       if (len < 0)
         len = 0;
       if (len > E.screencols)
         len = E.screencols;
-      char *c = &E.row[filerow].render[E.coloff];
-      unsigned char *hl = &E.row[filerow].hl[E.coloff];
-      int current_color = -1;
-      int j;
-      // color digits
-      for (j = 0; j < len; j++) {
-        if (hl[j] == HL_NORMAL) {
-          if (current_color != -1) {
-            abAppend(ab, "\x1b[39m", 5);
-            current_color = -1;
-          }
-          abAppend(ab, "\x1b[39m]", 5);
-          abAppend(ab, &c[j], 1);
-        } else {
-          int color = editorSyntaxToColor(hl[j]);
-          if (color != current_color) {
-            current_color = color;
-            char buf[16];
-            int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-            abAppend(ab, buf, clen);
-          }
-          abAppend(ab, &c[j], 1);
+      char *c = &row->render[E.coloff];
+      unsigned char *hl = &row->hl[E.coloff];
+      int j = 0;
+      // copy runs of equally highlighted chars at once
+      while (j < len) {
+        int run = j + 1;
+        while (run < len && hl[run] == hl[j])
+          run++;
+        int attr = hl[j] == HL_NORMAL ? 0 : editorSyntaxToColor(hl[j]);
+        screenPut(scr, y, j, &c[j], run - j, attr);
+        j = run;
+      }
+
+      // paint matches of the highlighted query over the syntax colors
+      if (E.hlquery) {
+        editorRowMatches(row);
+        for (j = 0; j < row->nmatches; j++) {
+          int *m = &row->matches[j * 2];
+          int from = editorRowCxToRx(row, m[0]) - E.coloff;
+          int to = editorRowCxToRx(row, m[1]) - E.coloff;
+          if (from < 0)
+            from = 0;
+          if (to > len)
+            to = len;
+          if (from < to)
+            screenPut(scr, y, from, &c[from], to - from,
+                      editorSyntaxToColor(HL_MATCH));
         }
       }
-      abAppend(ab, "\x1b[39m", 5);
     }
-    // clear from cursor to end of line
-    abAppend(ab, "\x1b[K", 3);
-    abAppend(ab, "\r\n", 2);
   }
 }
 
-// appends status bar chars to abuf
-void editorDrawStatusBar(struct abuf *ab) {
+// draws status bar on the row below the text
+void editorDrawStatusBar(struct screen *scr) {
   // [7m switches to inverted colors
-  abAppend(ab, "\x1b[31;7m", 7);
+  int attr = 31 | ATTR_INVERSE;
   char status[80], rstatus[80];
   // show first 20 chars of filename fllowed to number of lines
   // use [No Name] if no file is given
@@ -797,54 +4389,52 @@ void editorDrawStatusBar(struct abuf *ab) {
   int rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d", E.cy + 1, E.numrows);
   if (len > E.screencols)
     len = E.screencols;
-  abAppend(ab, status, len);
-  while (len < E.screencols) {
-    // append rstatus once thre is only rlen left in rows
-    if (E.screencols - len == rlen) {
-      abAppend(ab, rstatus, rlen);
-      break;
-
-    } else {
-      abAppend(ab, " ", 1);
-      len++;
-    }
-  }
-  // switch to normal formatting
-  abAppend(ab, "\x1b[m", 3);
-  // status bar is not the last line, messge line comes after it now
-  abAppend(ab, "\r\n", 2);
+  screenClearRow(scr, E.screenrows, attr);
+  screenPut(scr, E.screenrows, 0, status, len, attr);
+  // rstatus is right aligned if it fits after status
+  if (E.screencols - len >= rlen)
+    screenPut(scr, E.screenrows, E.screencols - rlen, rstatus, rlen, attr);
 }
 
-void editorDrawMessageBar(struct abuf *ab) {
-  // clear from cursor to end of line
-  abAppend(ab, "\x1b[K", 3);
+void editorDrawMessageBar(struct screen *scr) {
+  screenClearRow(scr, E.screenrows + 1, 0);
   int msglen = strlen(E.statusmsg);
   if (msglen > E.screencols)
     msglen = E.screencols;
   if (msglen && time(NULL) - E.statusmsg_time < 5)
-    abAppend(ab, E.statusmsg, msglen);
+    screenPut(scr, E.screenrows + 1, 0, E.statusmsg, msglen, 0);
 }
 
 // uses VT1oo escape sequances
 // https://vt100.net/docs/vt100-ug/chapter3.html
-// we hide the cursor before paiting and show it again after to avoid a flicker
-// (where curosr migh appear in the middle of screen for a split second)
+// the frame is drawn into E.frame and only cells that changed since the
+// last refresh are sent, so a keystroke costs a few dozen bytes instead of
+// a whole screen
 void editorRefreshScreen() {
   editorScroll();
 
-  struct abuf ab = ABUF_INIT;
-  // hide cursor
-  abAppend(&ab, "\x1b[?25l", 6);
-
-  // clear entire screen replaced with clearing each line as we draw them
-  // abAppend(&ab, "\x1b[2J]", 4);
-
-  // reposition cursor to top-left
-  abAppend(&ab, "\x1b[H", 3);
-
-  editorDrawRows(&ab);
-  editorDrawStatusBar(&ab);
-  editorDrawMessageBar(&ab);
+  editorDrawRows(&E.frame);
+  editorDrawStatusBar(&E.frame);
+  editorDrawMessageBar(&E.frame);
+
+  struct abuf *ab = &E.out;
+  ab->len = 0;
+  // hide cursor while painting to avoid a flicker (where curosr migh
+  // appear in the middle of screen for a split second)
+  abAppend(ab, "\x1b[?25l", 6);
+  int hidden = 1;
+
+  // text that is still on screen after scrolling is moved by the terminal
+  int scrolled = E.frame.rowoff - E.shown.rowoff;
+  if (scrolled != 0 && abs(scrolled) < E.screenrows)
+    editorScrollShown(ab, 0, E.screenrows, scrolled);
+
+  editorFlushScreen(ab);
+  if (ab->len == 6) {
+    // nothing changed, only the cursor moves
+    ab->len = 0;
+    hidden = 0;
+  }
 
   // move cursor on refresh
   char buf[32];
@@ -853,13 +4443,13 @@ void editorRefreshScreen() {
   // E.cx shows cursor position relative to file line start absolute
   snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1,
            (E.rx - E.coloff) + 1);
-  abAppend(&ab, buf, strlen(buf));
+  abAppend(ab, buf, strlen(buf));
 
   // show cursor
-  abAppend(&ab, "\x1b[?25h", 6);
+  if (hidden)
+    abAppend(ab, "\x1b[?25h", 6);
 
-  write(STDOUT_FILENO, ab.b, ab.len);
-  abFree(&ab);
+  editorWrite(ab->b, ab->len);
 }
 
 void editorSetStatusMessage(const char *fmt, ...) {
@@ -919,7 +4509,7 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
 
 void editorMoveCursor(int key) {
   // NULL for last line(since cy can go past file last line)
-  erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+  erow *row = (E.cy >= E.numrows) ? NULL : tbRow(&E.tb, E.cy);
 
   switch (key) {
   // Moving left at begening of line moves cursor to end of previous line
@@ -928,7 +4518,7 @@ void editorMoveCursor(int key) {
       E.cx--;
     } else if (E.cy > 0) {
       E.cy--;
-      E.cx = E.row[E.cy].size;
+      E.cx = tbRow(&E.tb, E.cy)->size;
     }
     break;
 
@@ -958,7 +4548,7 @@ void editorMoveCursor(int key) {
   }
   // check if our E.cx is past the eol of new cy
   // shouldnt we first check if cy even changed?
-  row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+  row = (E.cy >= E.numrows) ? NULL : tbRow(&E.tb, E.cy);
   int rowlen = row ? row->size : 0;
   if (E.cx > rowlen) {
     E.cx = rowlen;
@@ -981,10 +4571,14 @@ void editorProcessKeypress() {
     case 'v':
       E.mode = VISUAL_MODE;
       break;
-    case ':':
+    case ':': {
       // E.mode = COMMAND_MODE;
-      editorPrompt(": %s", NULL);
-      break;
+      char *cmd = editorPrompt(": %s", NULL);
+      if (cmd) {
+        editorCommand(cmd);
+        free(cmd);
+      }
+    } break;
     case '/':
       E.mode = SEARCH_MODE;
       break;
@@ -996,7 +4590,7 @@ void editorProcessKeypress() {
     case END_KEY:
     case '$':
       if (E.cy < E.numrows) {
-        E.cx = E.row[E.cy].size;
+        E.cx = tbRow(&E.tb, E.cy)->size;
       }
       break;
 
@@ -1067,7 +4661,7 @@ void editorProcessKeypress() {
 
     case END_KEY:
       if (E.cy < E.numrows) {
-        E.cx = E.row[E.cy].size;
+        E.cx = tbRow(&E.tb, E.cy)->size;
       }
       break;
 
@@ -1153,6 +4747,87 @@ void editorProcessKeypress() {
   quit_times = KILO_QUIT_TIMES;
 }
 
+/*** bench ***/
+
+uint64_t editorNow() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int editorCompareLat(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+// registered with atexit so it runs however the script ends
+void editorBenchReport() {
+  struct benchState *b = E.bench;
+  uint64_t elapsed = editorNow() - b->start;
+  uint64_t p50 = 0, p99 = 0;
+
+  if (b->nlat) {
+    qsort(b->lat, b->nlat, sizeof(uint64_t), editorCompareLat);
+    p50 = b->lat[b->nlat / 2];
+    p99 = b->lat[(b->nlat * 99) / 100];
+  }
+  printf("open_ms %.3f\n", b->opentime / 1e6);
+  printf("keys %ld\n", b->keys);
+  printf("keys_per_sec %.0f\n", elapsed ? b->keys * 1e9 / elapsed : 0.0);
+  printf("frames %ld\n", b->frames);
+  printf("bytes_per_frame %.1f\n",
+         b->frames ? (double)b->bytes / b->frames : 0.0);
+  printf("latency_p50_us %.2f\n", p50 / 1e3);
+  printf("latency_p99_us %.2f\n", p99 / 1e3);
+  printf("output_allocs %d\n", E.out.allocs);
+}
+
+// load the key script, must run before initEditor
+void editorBenchInit(char *script) {
+  static struct benchState b;
+  int fd = open(script, O_RDONLY);
+  if (fd == -1)
+    die("open");
+
+  size_t cap = 4096;
+  ssize_t nread;
+  b.script = malloc(cap);
+  while ((nread = read(fd, &b.script[b.len], cap - b.len)) > 0) {
+    b.len += nread;
+    if (b.len == cap) {
+      cap *= 2;
+      b.script = realloc(b.script, cap);
+    }
+  }
+  if (nread == -1)
+    die("read");
+  close(fd);
+
+  b.latcap = 1024;
+  b.lat = malloc(sizeof(uint64_t) * b.latcap);
+  E.bench = &b;
+  atexit(editorBenchReport);
+}
+
+// drive the editor from the script until it runs out
+// each key is timed through editorProcessKeypress and the refresh after it
+void editorBench() {
+  struct benchState *b = E.bench;
+  editorRefreshScreen();
+  b->start = editorNow();
+  while (1) {
+    uint64_t t = editorNow();
+    editorProcessKeypress();
+    editorRefreshScreen();
+    if (b->nlat == b->latcap) {
+      b->latcap *= 2;
+      b->lat = realloc(b->lat, sizeof(uint64_t) * b->latcap);
+    }
+    b->lat[b->nlat++] = editorNow() - t;
+  }
+}
+
 /*** init ***/
 
 void initEditor() {
@@ -1162,22 +4837,52 @@ void initEditor() {
   E.rowoff = 0;
   E.coloff = 0;
   E.numrows = 0;
-  E.row = NULL;
+  memset(&E.tb, 0, sizeof(E.tb));
   E.dirty = 0;
   E.filename = NULL;
   E.statusmsg[0] = '\0';
   E.statusmsg_time = 0;
   E.mode = NORMAL_MODE;
+  E.hlsearch = 0;
+  E.regex = 0;
+  E.hlquery = NULL;
+  E.matchgen = 1;
+  E.syntax = NULL;
+  E.hlvalid = 0;
+  editorSyntaxInit();
 
   if (getWindowSize(&E.screenrows, &E.screencols) == -1)
     die("getWindowSize");
   // reserve last two rows for status bar and messge line
   E.screenrows -= 2;
+
+  E.out = (struct abuf)ABUF_INIT;
+  screenInit(&E.frame, E.screenrows + 2, E.screencols);
+  screenInit(&E.shown, E.screenrows + 2, E.screencols);
 }
 
+// bench.c includes this file for the editor core and brings its own main
+#ifndef KILO_NO_MAIN
 int main(int argc, char *argv[]) {
+  // kilo --bench <script> [file] runs headless, see editorBench
+  if (argc >= 2 && strcmp(argv[1], "--bench") == 0) {
+    if (argc < 3) {
+      fprintf(stderr, "usage: %s --bench <script> [file]\n", argv[0]);
+      return 1;
+    }
+    editorBenchInit(argv[2]);
+    initEditor();
+    if (argc >= 4) {
+      uint64_t t = editorNow();
+      editorOpen(argv[3]);
+      E.bench->opentime = editorNow() - t;
+    }
+    editorBench();
+  }
+
   enableRawMode();
   initEditor();
+  hlWorkerStart();
   if (argc >= 2) {
     editorOpen(argv[1]);
   }
@@ -1191,3 +4896,4 @@ int main(int argc, char *argv[]) {
   }
   return 0;
 }
+#endif
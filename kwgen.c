@@ -0,0 +1,158 @@
+// builds the keyword tables in keywords.h into perfect hash tables
+// usage: kwgen > keywords_hash.h, run by make before kilo is compiled
+// every list gets about half as many buckets as it has words. buckets
+// are placed biggest first, each one trying displacements until all of
+// its words land in free slots of a table twice the size of the list
+
+#define KWGEN
+#include "keywords.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KWGEN_MAX_DISP 65535
+#define KWGEN_MAX_LEN 16 // longest word a key holds
+
+struct kwWord {
+  const char *word;
+  int len;
+  int cls;
+  uint32_t hash;
+  int bucket;
+};
+
+struct kwBucket {
+  int id;
+  int nwords;
+};
+
+int kwCompareBuckets(const void *a, const void *b) {
+  const struct kwBucket *x = a;
+  const struct kwBucket *y = b;
+  if (x->nwords != y->nwords)
+    return y->nwords - x->nwords;
+  return x->id - y->id;
+}
+
+// write the table for list as name_kw, exits if no displacement works
+void kwgenList(const char *name, const char **list) {
+  int n = 0;
+  while (list[n])
+    n++;
+
+  struct kwWord *words = malloc(sizeof(struct kwWord) * n);
+  int nbuckets = 1;
+  while (nbuckets < n / 2)
+    nbuckets *= 2;
+  uint32_t size = 16;
+  while (size < (uint32_t)n * 2)
+    size *= 2;
+  int minlen = 0, maxlen = 0;
+  int i, j;
+  for (i = 0; i < n; i++) {
+    words[i].word = list[i];
+    words[i].len = strlen(list[i]);
+    words[i].cls = KW_KEYWORD;
+    if (list[i][words[i].len - 1] == '|') {
+      words[i].len--;
+      words[i].cls = KW_TYPE;
+    }
+    if (words[i].len > KWGEN_MAX_LEN) {
+      fprintf(stderr, "kwgen: %s is too long for %s\n", list[i], name);
+      exit(1);
+    }
+    char buf[KWGEN_MAX_LEN] = {0};
+    uint64_t key[2];
+    memcpy(buf, list[i], words[i].len);
+    kwKey(buf, words[i].len, key);
+    words[i].hash = kwHash(key);
+    words[i].bucket = kwSlot(words[i].hash, 0) & (nbuckets - 1);
+    if (i == 0 || words[i].len < minlen)
+      minlen = words[i].len;
+    if (words[i].len > maxlen)
+      maxlen = words[i].len;
+  }
+
+  struct kwBucket *buckets = calloc(nbuckets, sizeof(struct kwBucket));
+  for (i = 0; i < nbuckets; i++)
+    buckets[i].id = i;
+  for (i = 0; i < n; i++)
+    buckets[words[i].bucket].nwords++;
+  qsort(buckets, nbuckets, sizeof(struct kwBucket), kwCompareBuckets);
+
+  int *slots = malloc(sizeof(int) * size); // word in each slot, -1 if free
+  for (i = 0; i < (int)size; i++)
+    slots[i] = -1;
+  uint16_t *disp = calloc(nbuckets, sizeof(uint16_t));
+  uint32_t *tried = malloc(sizeof(uint32_t) * n);
+
+  for (i = 0; i < nbuckets && buckets[i].nwords; i++) {
+    int id = buckets[i].id;
+    uint32_t d;
+    for (d = 1; d <= KWGEN_MAX_DISP; d++) {
+      int ok = 1;
+      int ntried = 0;
+      for (j = 0; j < n && ok; j++) {
+        if (words[j].bucket != id)
+          continue;
+        uint32_t slot = kwSlot(words[j].hash, d) & (size - 1);
+        int k;
+        if (slots[slot] != -1)
+          ok = 0;
+        for (k = 0; k < ntried; k++)
+          if (tried[k] == slot)
+            ok = 0;
+        tried[ntried++] = slot;
+      }
+      if (ok)
+        break;
+    }
+    if (d > KWGEN_MAX_DISP) {
+      fprintf(stderr, "kwgen: no perfect hash for %s\n", name);
+      exit(1);
+    }
+    disp[id] = d;
+    for (j = 0; j < n; j++)
+      if (words[j].bucket == id)
+        slots[kwSlot(words[j].hash, d) & (size - 1)] = j;
+  }
+
+  printf("static const char %s_kwwords[%u][16] = {\n", name, size);
+  for (i = 0; i < (int)size; i++) {
+    if (slots[i] == -1)
+      printf("    \"\",\n");
+    else
+      printf("    \"%.*s\",\n", words[slots[i]].len, words[slots[i]].word);
+  }
+  printf("};\n\n");
+
+  printf("static const unsigned char %s_kwcls[%u] = {", name, size);
+  for (i = 0; i < (int)size; i++)
+    printf("%s%d", i == 0 ? "\n    " : i % 16 ? ", " : ",\n    ",
+           slots[i] == -1 ? KW_NONE : words[slots[i]].cls);
+  printf("};\n\n");
+
+  printf("static const uint16_t %s_kwdisp[%d] = {", name, nbuckets);
+  for (i = 0; i < nbuckets; i++)
+    printf("%s%u", i == 0 ? "\n    " : i % 12 ? ", " : ",\n    ", disp[i]);
+  printf("};\n\n");
+
+  printf("static const struct keywordTable %s_kw = {\n", name);
+  printf("    %s_kwwords, %s_kwcls, %s_kwdisp, %du, %uu, %d, %d};\n\n", name,
+         name, name, nbuckets - 1, size - 1, minlen, maxlen);
+
+  free(words);
+  free(buckets);
+  free(slots);
+  free(disp);
+  free(tried);
+}
+
+int main() {
+  printf("// generated by kwgen from keywords.h, do not edit\n\n");
+#define KWGEN_LIST(name, list) kwgenList(#name, list);
+  KWGEN_LISTS
+#undef KWGEN_LIST
+  return 0;
+}